@@ -0,0 +1,16 @@
+######################################################################
+# Headless benchmarks for the Minefield engine
+######################################################################
+
+TEMPLATE = app
+TARGET = mfbench
+DEPENDPATH += . ..
+INCLUDEPATH += . ..
+CONFIG += c++14
+CONFIG += console
+CONFIG -= app_bundle
+QT -= gui
+
+# Input
+HEADERS += bombcount.h celllayout.h chunkedminefield.h constraintmatrix.h fixedminefield.h minefield.h minefieldestimator.h minefieldpool.h minefieldprobability.h minefieldsolver.h neighborhood.h parallel.h rng.h
+SOURCES += bombcount.cpp chunkedminefield.cpp constraintmatrix.cpp mfbench.cpp minefield.cpp minefieldestimator.cpp minefieldpool.cpp minefieldprobability.cpp minefieldsolver.cpp parallel.cpp
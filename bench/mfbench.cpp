@@ -0,0 +1,1220 @@
+/*
+  mfbench.cpp
+ 
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/time.h>
+
+#include "minefield.h"
+#include "bombcount.h"
+#include "chunkedminefield.h"
+#include "fixedminefield.h"
+#include "minefieldpool.h"
+#include "minefieldestimator.h"
+#include "minefieldprobability.h"
+#include "minefieldsolver.h"
+#include "parallel.h"
+#include "rng.h"
+
+// Every heap allocation the benchmark makes is counted here, so the reuse
+// benchmark can show that it makes none.  (They're noinline so GCC
+// doesn't see malloc() and free() behind new and delete and warn.)
+static std::atomic<size_t> heap_allocations(0);
+
+__attribute__((noinline)) void *operator new(size_t n) {
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  void *p = std::malloc(n ? n : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  operator delete(p);
+}
+
+// Set by the benchmarks that check their results, so the run exits
+// non-zero when one goes wrong
+static bool check_failed = false;
+
+/*!
+  Returns the wall clock time in seconds.
+*/
+static double now() {
+  timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec*1.0e-6;
+}
+
+/*!
+  Opens the biggest region it can find on an n^3 board with the given
+  number of mines and reports how many cells per second touch() opened.
+*/
+static void benchCascade(size_t n, int mines) {
+  Minefield mf(n, n, n, mines, 1);
+
+  // Find an empty cell to click on
+  size_t x=0, y=0, z=0;
+  bool found = false;
+  for (size_t k=0; k<n && !found; ++k) {
+    for (size_t j=0; j<n && !found; ++j) {
+      for (size_t i=0; i<n && !found; ++i) {
+	if (mf.getState(i,j,k)==closed && mf.bombsNear(i,j,k)==0) {
+	  x = i; y = j; z = k;
+	  found = true;
+	}
+      }
+    }
+  }
+  if (!found) {
+    std::cout << "cascade " << n << "^3: no empty cell to click\n";
+    return;
+  }
+
+  double start = now();
+  size_t opened = mf.touch(x,y,z);
+  double elapsed = now() - start;
+
+  std::cout << "cascade " << n << "^3, " << mines << " mines, "
+	    << workerThreads() << " threads: "
+	    << opened << " cells in " << elapsed << " s, "
+	    << opened/elapsed << " cells/s\n";
+}
+
+/*!
+  Times countBombsNear() on an n^3 board where about one cell in
+  `spacing` is a bomb, and reports the throughput in cells per second.
+*/
+static void benchCounts(size_t n, size_t spacing) {
+  size_t total = n*n*n;
+  unsigned char *cells = new unsigned char[total];
+  std::srand(1);
+  for (size_t i=0; i<total; ++i) {
+    cells[i] = (std::rand() % spacing) == 0;
+  }
+
+  double start = now();
+  countBombsNear(cells, n, n, n);
+  double elapsed = now() - start;
+
+  std::cout << "counts " << n << "^3 (" << bombCountKernel() << "): "
+	    << elapsed << " s, " << total/elapsed << " cells/s\n";
+  delete[] cells;
+}
+
+/*!
+  Opens a region in the middle of a ChunkedMinefield that's n cells on a
+  side, and reports how many chunks (and how much memory) it needed.
+*/
+static void benchChunked(size_t n, double density) {
+  ChunkedMinefield mf(n, n, n, density, 1);
+
+  // Find an empty cell near the middle to click on
+  size_t c = n/2;
+  size_t x = c;
+  while (x < n && (mf.getState(x,c,c) != closed || mf.bombsNear(x,c,c) != 0)) {
+    ++x;
+  }
+  if (x == n) {
+    std::cout << "chunked " << n << "^3: no empty cell to click\n";
+    return;
+  }
+
+  double start = now();
+  size_t opened = mf.touch(x,c,c);
+  double elapsed = now() - start;
+
+  std::cout << "chunked " << n << "^3, density " << density << ": "
+	    << opened << " cells in " << elapsed << " s, "
+	    << mf.chunksAllocated() << " chunks, "
+	    << mf.chunkBytes()/1024 << " KB\n";
+}
+
+/*!
+  Times building an n^3 board with the given fraction of mines.
+*/
+static void benchGenerate(size_t n, double density) {
+  int mines = int(density*n*n*n);
+
+  double start = now();
+  Minefield mf(n, n, n, mines, 1);
+  double elapsed = now() - start;
+
+  std::cout << "generate " << n << "^3, density " << density << ": "
+	    << elapsed << " s\n";
+}
+
+/*!
+  Reference neighbor count over an unpadded row major array of bomb
+  flags, clamping the 3x3x3 block at the edges like the old bombsNear().
+*/
+static size_t rowMajorCount(const unsigned char *bombs, size_t n,
+			    size_t x, size_t y, size_t z) {
+  size_t x_min = (x>0) ? x-1 : x, x_max = (x+1<n) ? x+1 : x;
+  size_t y_min = (y>0) ? y-1 : y, y_max = (y+1<n) ? y+1 : y;
+  size_t z_min = (z>0) ? z-1 : z, z_max = (z+1<n) ? z+1 : z;
+  size_t count = 0;
+  for (size_t k=z_min; k<=z_max; ++k) {
+    for (size_t j=y_min; j<=y_max; ++j) {
+      for (size_t i=x_min; i<=x_max; ++i) {
+	count += bombs[(k*n + j)*n + i];
+      }
+    }
+  }
+  return count;
+}
+
+/*!
+  Compares neighbor loops on the old unpadded row major layout, which
+  needs bounds checks, with the padded row major layout, where the 26
+  neighbors are fixed offsets, and the bricked layout, where they come
+  from a table.  All three count the bombs around every cell, and then
+  all three flood fill the same opening.
+*/
+static void benchLayouts(size_t n) {
+  Minefield mf(n, n, n, int(n*n*n/1000), 1);
+  Minefield bricked_mf(n, n, n, int(n*n*n/1000), 1, bricked_layout);
+  size_t p = n+2;
+  BrickedLayout bl;
+  bl.resize(n,n,n);
+
+  // Copy the bombs out in all three layouts
+  std::vector<unsigned char> flat(n*n*n), padded(p*p*p, 0), bricked(bl.slots(), 0);
+  for (size_t k=0; k<n; ++k) {
+    for (size_t j=0; j<n; ++j) {
+      for (size_t i=0; i<n; ++i) {
+	unsigned char bomb = (mf.getState(i,j,k) == closed_bomb);
+	flat[(k*n + j)*n + i] = bomb;
+	padded[((k+1)*p + j+1)*p + i+1] = bomb;
+	bricked[bl.slot(i,j,k)] = bomb;
+      }
+    }
+  }
+
+  ptrdiff_t offsets[27];
+  size_t m = 0;
+  for (int dz=-1; dz<=1; ++dz) {
+    for (int dy=-1; dy<=1; ++dy) {
+      for (int dx=-1; dx<=1; ++dx) {
+	offsets[m++] = dx + ptrdiff_t(p)*(dy + ptrdiff_t(p)*dz);
+      }
+    }
+  }
+
+  // Neighbor counts
+  std::vector<unsigned char> flat_counts(n*n*n);
+  double start = now();
+  for (size_t k=0; k<n; ++k) {
+    for (size_t j=0; j<n; ++j) {
+      for (size_t i=0; i<n; ++i) {
+	flat_counts[(k*n + j)*n + i] = rowMajorCount(&flat[0], n, i, j, k);
+      }
+    }
+  }
+  double flat_time = now() - start;
+
+  std::vector<unsigned char> padded_counts(p*p*p);
+  start = now();
+  for (size_t k=1; k<=n; ++k) {
+    for (size_t j=1; j<=n; ++j) {
+      size_t row = (k*p + j)*p;
+      for (size_t i=row+1; i<=row+n; ++i) {
+	unsigned char count = 0;
+	for (size_t o=0; o<27; ++o) {
+	  count += padded[i + offsets[o]];
+	}
+	padded_counts[i] = count;
+      }
+    }
+  }
+  double padded_time = now() - start;
+
+  // The bricked loop goes through the cells in storage order, a brick at
+  // a time, skipping the border
+  std::vector<unsigned char> bricked_counts(bl.slots());
+  start = now();
+  for (size_t s=0; s<bricked.size(); ++s) {
+    size_t x, y, z;
+    bl.position(s,x,y,z);
+    if (x >= n || y >= n || z >= n) continue;
+    unsigned char count = bricked[s];
+    for (size_t k=0; k<26; ++k) {
+      count += bricked[bl.neighbor(s,k)];
+    }
+    bricked_counts[s] = count;
+  }
+  double bricked_time = now() - start;
+
+  std::cout << "layouts " << n << "^3 counts: unpadded " << flat_time
+	    << " s, padded " << padded_time << " s, bricked " << bricked_time << " s\n";
+
+  // Flood fill from the first empty cell, on the unpadded layout with
+  // bounds checks, then with Minefield::touch()
+  size_t first = 0;
+  while (first < n*n*n && (flat[first] || flat_counts[first])) {
+    ++first;
+  }
+  if (first == n*n*n) return;
+
+  std::vector<unsigned char> opened(n*n*n, 0);
+  std::vector<size_t> queue;
+  start = now();
+  opened[first] = 1;
+  queue.push_back(first);
+  for (size_t head=0; head<queue.size(); ++head) {
+    size_t idx = queue[head];
+    if (flat_counts[idx] != 0) continue;
+    size_t x = idx % n, y = (idx / n) % n, z = idx / (n*n);
+    for (int dz=-1; dz<=1; ++dz) {
+      for (int dy=-1; dy<=1; ++dy) {
+	for (int dx=-1; dx<=1; ++dx) {
+	  size_t nx = x+dx, ny = y+dy, nz = z+dz;
+	  if (nx<n && ny<n && nz<n) {
+	    size_t nidx = (nz*n + ny)*n + nx;
+	    if (!opened[nidx] && !flat[nidx]) {
+	      opened[nidx] = 1;
+	      queue.push_back(nidx);
+	    }
+	  }
+	}
+      }
+    }
+  }
+  double flat_cascade = now() - start;
+
+  size_t x = first % n, y = (first / n) % n, z = first / (n*n);
+  start = now();
+  size_t padded_opened = mf.touch(x,y,z);
+  double padded_cascade = now() - start;
+
+  start = now();
+  size_t bricked_opened = bricked_mf.touch(x,y,z);
+  double bricked_cascade = now() - start;
+
+  bool same = (queue.size() == padded_opened && queue.size() == bricked_opened);
+  std::cout << "layouts " << n << "^3 cascade of " << queue.size()
+	    << (same ? "" : " (COUNTS DIFFER)")
+	    << " cells: unpadded " << flat_cascade << " s, padded "
+	    << padded_cascade << " s, bricked " << bricked_cascade << " s\n";
+}
+
+/*!
+  Returns a hash of every cell's state, to check that two boards match.
+*/
+static uint64_t boardHash(Minefield &mf) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t k=0; k<mf.depth(); ++k) {
+    for (size_t j=0; j<mf.height(); ++j) {
+      for (size_t i=0; i<mf.width(); ++i) {
+	hash = (hash ^ mf.getState(i,j,k)) * 1099511628211ULL;
+      }
+    }
+  }
+  return hash;
+}
+
+/*!
+  Returns 1, 2, 4... up to and including the number of cores
+*/
+static std::vector<unsigned> threadCounts() {
+  unsigned cores = std::thread::hardware_concurrency();
+  if (cores == 0) cores = 1;
+
+  std::vector<unsigned> counts;
+  for (unsigned threads=1; threads<cores; threads*=2) {
+    counts.push_back(threads);
+  }
+  counts.push_back(cores);
+  return counts;
+}
+
+/*!
+  Times generating boards from 64^3 up to max^3 with 1, 2, 4... threads,
+  up to the number of cores, and checks the boards are all the same.
+*/
+static void benchScaling(size_t max) {
+  std::vector<unsigned> counts = threadCounts();
+  for (size_t n=64; n<=max; n*=2) {
+    uint64_t first_hash = 0;
+    for (size_t t=0; t<counts.size(); ++t) {
+      setWorkerThreads(counts[t]);
+
+      double start = now();
+      Minefield mf(n, n, n, int(0.2*n*n*n), 1);
+      double elapsed = now() - start;
+
+      uint64_t hash = boardHash(mf);
+      if (t == 0) first_hash = hash;
+      std::cout << "scaling " << n << "^3, " << counts[t] << " threads: "
+		<< elapsed << " s" << (hash == first_hash ? "" : " (BOARD DIFFERS)") << "\n";
+    }
+  }
+  setWorkerThreads(0);
+}
+
+/*!
+  Plays a game to the end by touching every cell that isn't a bomb, in
+  index order, and returns the number of cells opened.
+*/
+template <class M>
+static size_t playOut(M &mf) {
+  size_t opened = 0;
+  for (size_t k=0; k<mf.depth(); ++k) {
+    for (size_t j=0; j<mf.height(); ++j) {
+      for (size_t i=0; i<mf.width(); ++i) {
+	if (mf.getState(i,j,k) == closed) {
+	  opened += mf.touch(i,j,k);
+	}
+      }
+    }
+  }
+  return opened;
+}
+
+/*!
+  Times generating and playing out games at one of the built in
+  difficulty levels, with Minefield (which picks its FixedPaddedLayout
+  kernels for these sizes on its own) and with FixedMinefield, which
+  also keeps everything inline.
+*/
+template <size_t N>
+static void benchFixed(int mines, size_t games) {
+  size_t dynamic_opened = 0, fixed_opened = 0;
+
+  double start = now();
+  for (size_t g=0; g<games; ++g) {
+    Minefield mf(N, N, N, mines, g);
+    dynamic_opened += playOut(mf);
+  }
+  double dynamic_time = now() - start;
+
+  start = now();
+  for (size_t g=0; g<games; ++g) {
+    FixedMinefield<N,N,N> mf(mines, g);
+    fixed_opened += playOut(mf);
+  }
+  double fixed_time = now() - start;
+
+  std::cout << "fixed " << N << "^3, " << mines << " mines, " << games << " games: Minefield "
+	    << dynamic_time*1e6/games << " us, FixedMinefield " << fixed_time*1e6/games << " us"
+	    << (dynamic_opened == fixed_opened ? "" : " (COUNTS DIFFER)") << "\n";
+}
+
+/*!
+  Plays a game by clicking random closed cells until one is a bomb or
+  the game is won.  Returns the number of cells opened.
+*/
+template <class M>
+static size_t playRandom(M &mf, Xoshiro256 &rng) {
+  size_t opened = 0;
+  while (!mf.hasWon()) {
+    size_t x = rng.below(mf.width()), y = rng.below(mf.height()), z = rng.below(mf.depth());
+    mf_state_t st = mf.getState(x,y,z);
+    if (st == closed_bomb) break;
+    if (st == closed) {
+      opened += mf.touch(x,y,z);
+    }
+  }
+  return opened;
+}
+
+/*!
+  Times playing random games on n^3 boards through withBoard(), which
+  picks FixedMinefield at the difficulty levels' sizes, against always
+  using Minefield.
+*/
+static void benchPlay(size_t n, int mines, size_t games) {
+  size_t chosen_opened = 0, dynamic_opened = 0;
+
+  double start = now();
+  for (size_t g=0; g<games; ++g) {
+    Xoshiro256 rng(g);
+    withBoard(n, mines, g, [&](auto &mf) {
+	chosen_opened += playRandom(mf, rng);
+      });
+  }
+  double chosen_time = now() - start;
+
+  start = now();
+  for (size_t g=0; g<games; ++g) {
+    Xoshiro256 rng(g);
+    Minefield mf(n, n, n, mines, g);
+    dynamic_opened += playRandom(mf, rng);
+  }
+  double dynamic_time = now() - start;
+
+  std::cout << "play " << n << "^3, " << mines << " mines, " << games << " games: withBoard "
+	    << chosen_time*1e6/games << " us, Minefield " << dynamic_time*1e6/games << " us"
+	    << (chosen_opened == dynamic_opened ? "" : " (COUNTS DIFFER)") << "\n";
+}
+
+/*!
+  Returns true if two changes() lists hold the same cells and states,
+  in whatever order.
+*/
+static bool sameChanges(std::vector<mf_change_t> a, std::vector<mf_change_t> b) {
+  auto by_index = [](const mf_change_t &l, const mf_change_t &r) { return l.index < r.index; };
+  std::sort(a.begin(), a.end(), by_index);
+  std::sort(b.begin(), b.end(), by_index);
+  if (a.size() != b.size()) return false;
+  for (size_t i=0; i<a.size(); ++i) {
+    if (a[i].index != b[i].index || a[i].state != b[i].state) return false;
+  }
+  return true;
+}
+
+/*!
+  Times labelling the openings of an n^3 board, and then opening the
+  biggest one from its list, against the same opening done by the flood
+  fill on a board without labels.  It then checks that both boards report
+  the same changes() for that touch and for touches on random cells, and
+  fails the run if they don't.
+*/
+static void benchRegions(size_t n) {
+  int mines = int(n*n*n/200);
+  Minefield labelled(n, n, n, mines, 1);
+  Minefield unlabelled(n, n, n, mines, 1);
+  unlabelled.setRegionLabels(false);
+
+  double start = now();
+  labelled.setRegionLabels(true);
+  double label_time = now() - start;
+
+  // The middle of the board is usually in the biggest opening
+  size_t c = n/2;
+  size_t x = c;
+  while (x < n && (labelled.getState(x,c,c) != closed || labelled.bombsNear(x,c,c) != 0)) {
+    ++x;
+  }
+  if (x == n) return;
+
+  start = now();
+  size_t opened = labelled.touch(x,c,c);
+  double list_time = now() - start;
+
+  start = now();
+  size_t flood_opened = unlabelled.touch(x,c,c);
+  double flood_time = now() - start;
+
+  bool same = (opened == flood_opened) && sameChanges(labelled.changes(), unlabelled.changes());
+  Xoshiro256 rng(n);
+  for (size_t t=0; t<100 && same; ++t) {
+    size_t rx = rng.below(n), ry = rng.below(n), rz = rng.below(n);
+    if (labelled.getState(rx,ry,rz) != closed) continue;
+    same = (labelled.touch(rx,ry,rz) == unlabelled.touch(rx,ry,rz))
+      && sameChanges(labelled.changes(), unlabelled.changes());
+  }
+  check_failed |= !same;
+
+  std::cout << "regions " << n << "^3: labelling " << label_time << " s; opening "
+	    << opened << " cells from the list " << list_time << " s, by flood fill "
+	    << flood_time << " s" << (same ? "" : " (CHANGES DIFFER)") << "\n";
+}
+
+/*!
+  Times generating and playing out n^3 boards with each stencil on a
+  bounded board and on a torus.  The first line is the original 26
+  neighbor bounded board, for comparison.
+*/
+static void benchNeighborhoods(size_t n, size_t games) {
+  static const char *stencils[] = {"26", "18", "6"};
+  static const char *topologies[] = {"bounded", "torus"};
+  int mines = int(n*n*n/10);
+  for (int t=bounded_topology; t<=torus_topology; ++t) {
+    for (int s=corner_stencil; s<=face_stencil; ++s) {
+      Minefield mf(n, n, n, mines, 0);
+      mf.setNeighborhood(mf_stencil_t(s), mf_topology_t(t));
+
+      double generate_time = 0, play_time = 0;
+      size_t opened = 0;
+      for (size_t g=1; g<=games; ++g) {
+	double start = now();
+	mf.reset(n, n, n, mines, g);
+	double generated = now();
+	opened += playOut(mf);
+	generate_time += generated - start;
+	play_time += now() - generated;
+      }
+      std::cout << "neighborhoods " << n << "^3, " << stencils[s] << " neighbors, "
+		<< topologies[t] << ": generate " << generate_time*1e6/games << " us, play "
+		<< play_time*1e6/games << " us, " << opened/games << " cells\n";
+    }
+  }
+}
+
+/*!
+  Forks an n^3 board with half its cells opened over and over, as a
+  search would, and reports the time and heap allocations per fork, for
+  forks that are only looked at and forks that make one move.
+*/
+static void benchFork(size_t n, size_t forks) {
+  int mines = int(n*n*n/10);
+  Minefield root(n, n, n, mines, 1);
+  Xoshiro256 rng(1);
+  while (root.cellsOpened() < (n*n*n-mines)/2) {
+    size_t x = rng.below(n), y = rng.below(n), z = rng.below(n);
+    if (root.getState(x,y,z) == closed) {
+      root.touch(x,y,z);
+    }
+  }
+
+  size_t looked = 0;
+  size_t allocs = heap_allocations;
+  double start = now();
+  for (size_t f=0; f<forks; ++f) {
+    Minefield branch = root.fork();
+    looked += branch.getState(f%n, f/n%n, 0);
+  }
+  double look_time = now() - start;
+  size_t look_allocs = heap_allocations - allocs;
+
+  size_t opened = 0;
+  allocs = heap_allocations;
+  start = now();
+  for (size_t f=0; f<forks; ++f) {
+    Minefield branch = root.fork();
+    size_t x = rng.below(n), y = rng.below(n), z = rng.below(n);
+    if (branch.getState(x,y,z) == closed) {
+      opened += branch.touch(x,y,z);
+    }
+  }
+  double move_time = now() - start;
+  size_t move_allocs = heap_allocations - allocs;
+
+  std::cout << "fork " << n << "^3, " << forks << " forks: looking " << look_time*1e6/forks
+	    << " us, " << double(look_allocs)/forks << " allocs; one move "
+	    << move_time*1e6/forks << " us, " << double(move_allocs)/forks << " allocs ("
+	    << opened << " cells, " << looked << ")\n";
+}
+
+/*!
+  Has a bot play games on n^3 boards: it clicks random closed cells the
+  solver hasn't proven to be mines, and lets the solver open the cells
+  that are certainly safe after each one.  Reports how long the solver
+  took to catch up after each click, against solving the board from
+  scratch, and how many games the bot won.
+*/
+static void benchSolver(size_t n, size_t games) {
+  int mines = int(n*n*n/20);
+  size_t won = 0, solved = 0;
+  size_t clicks[2] = {0, 0};
+  double update_time[2] = {0.0, 0.0}, scratch_time[2] = {0.0, 0.0};
+  double open_time = 0.0;
+  for (size_t g=0; g<games; ++g) {
+    Minefield mf(n, n, n, mines, g+1);
+    MinefieldSolver solver(mf);
+    Xoshiro256 rng(g+1);
+    while (!mf.hasWon()) {
+      size_t x = rng.below(n), y = rng.below(n), z = rng.below(n);
+      mf_state_t st = mf.getState(x,y,z);
+      if ((st != closed && st != closed_bomb) || solver.isMine(mf.cellIndex(x,y,z))) continue;
+      if (st == closed_bomb) break;
+
+      // Clicks on numbered cells, and clicks that open a region
+      size_t kind = (mf.touch(x,y,z) > 1);
+      ++clicks[kind];
+      Minefield copy = mf.fork();
+      double start = now();
+      MinefieldSolver fresh(copy);
+      scratch_time[kind] += now() - start;
+
+      start = now();
+      solver.update();
+      update_time[kind] += now() - start;
+
+      start = now();
+      solved += solver.openSafe();
+      open_time += now() - start;
+    }
+    won += mf.hasWon();
+  }
+
+  std::cout << "solver " << n << "^3, " << games << " games: won " << won << "; update() "
+	    << update_time[0]*1e6/clicks[0] << " us per numbered cell clicked, "
+	    << update_time[1]*1e6/clicks[1] << " us per region opened; from scratch "
+	    << scratch_time[0]*1e6/clicks[0] << " us and " << scratch_time[1]*1e6/clicks[1]
+	    << " us; opened " << solved << " cells in " << open_time << " s\n";
+}
+
+/*!
+  Opens random cells on an n^3 board with a mine in every sixth cell
+  until the frontier has n^3/8 constraints, then times eliminate() on
+  it, and counts the cells it proves that the other rules couldn't.
+*/
+static void benchElimination(size_t n) {
+  int mines = int(n*n*n/6);
+  Minefield mf(n, n, n, mines, 7);
+  MinefieldSolver solver(mf);
+  Xoshiro256 rng(9);
+  while (solver.frontier().size() < n*n*n/8 && mf.cellsOpened() < n*n*n/2) {
+    size_t x = rng.below(n), y = rng.below(n), z = rng.below(n);
+    if (mf.getState(x,y,z) == closed) {
+      mf.touch(x,y,z);
+      solver.update();
+    }
+  }
+
+  size_t before = solver.mineCells().size() + solver.safeCells().size();
+  double start = now();
+  size_t proved = solver.eliminate();
+  double elapsed = now() - start;
+  size_t after = solver.mineCells().size() + solver.safeCells().size();
+  std::cout << "elimination " << n << "^3: " << solver.frontier().size() << " constraints in "
+	    << elapsed*1000.0 << " ms, proved " << proved << " cells, " << after - before
+	    << " with what they led to, " << solver.overflowed() << " row operations overflowed\n";
+}
+
+/*!
+  Has two bots play the same games on n^3 boards, opening what the
+  solver proves safe after each click.  When they have to guess, one
+  clicks a random closed cell the solver hasn't proven to be a mine and
+  the other clicks the cell MinefieldProbability says is safest.
+  Reports how many games each won, how long compute() took, how many
+  components it found in its cache and how long it spent counting.
+*/
+static void benchProbability(size_t n, size_t games) {
+  int mines = int(n*n*n/8);
+  size_t won[2] = {0, 0};
+  size_t guesses = 0, failed = 0, biggest = 0, hits = 0, misses = 0;
+  double compute_time = 0.0, count_time = 0.0;
+  for (size_t g=0; g<games; ++g) {
+    for (int bot=0; bot<2; ++bot) {
+      Minefield mf(n, n, n, mines, g+1);
+      MinefieldSolver solver(mf);
+      MinefieldProbability probability(solver);
+      Xoshiro256 rng(g+1);
+      while (!mf.hasWon()) {
+	size_t index = 0;
+	bool chosen = false;
+	if (bot == 1 && mf.cellsOpened() > 0) {
+	  double start = now();
+	  bool exact = probability.compute();
+	  compute_time += now() - start;
+	  ++guesses;
+	  failed += !exact;
+	  for (size_t c=0; c<probability.components().size(); ++c) {
+	    biggest = std::max(biggest, probability.components()[c].cells.size());
+	  }
+	  chosen = exact && probability.safestCell(index);
+	}
+	while (!chosen) {
+	  index = mf.cellIndex(rng.below(n), rng.below(n), rng.below(n));
+	  size_t x, y, z;
+	  mf.cellPosition(index, x, y, z);
+	  mf_state_t st = mf.getState(x,y,z);
+	  chosen = (st == closed || st == closed_bomb) && !solver.isMine(index);
+	}
+
+	size_t x, y, z;
+	mf.cellPosition(index, x, y, z);
+	if (mf.getState(x,y,z) == closed_bomb) break;
+	mf.touch(x,y,z);
+	solver.update();
+	solver.openSafe();
+      }
+      won[bot] += mf.hasWon();
+      hits += probability.cacheHits();
+      misses += probability.cacheMisses();
+      count_time += probability.countTime();
+    }
+  }
+
+  std::cout << "probability " << n << "^3, " << games << " games: won " << won[0]
+	    << " guessing at random, " << won[1] << " guessing the safest cell; compute() "
+	    << compute_time*1e6/guesses << " us per guess, " << failed << " of " << guesses
+	    << " over the limit, biggest component " << biggest << " cells; "
+	    << hits << " of " << hits + misses << " components cached, counting "
+	    << count_time*1e6/guesses << " us per guess\n";
+}
+
+/*!
+  Opens the cells the solver has proven safe behind its back, straight
+  through the board, and runs compute() before the solver catches up,
+  on games of n^3 boards.  compute() works from the solver's last view,
+  so the interior it counts must still fit on the board; the run fails
+  if it doesn't.
+*/
+static void benchStaleSolver(size_t n, int mines, size_t games) {
+  size_t cells = n*n*n, computed = 0, bad = 0;
+  for (size_t g=0; g<games; ++g) {
+    Minefield mf(n, n, n, mines, g+1);
+    MinefieldSolver solver(mf);
+    MinefieldProbability probability(solver);
+    Xoshiro256 rng(g+1);
+    for (size_t move=0; move<20 && !mf.hasWon(); ++move) {
+      size_t x = rng.below(n), y = rng.below(n), z = rng.below(n);
+      if (mf.getState(x,y,z) != closed) continue;
+      mf.touch(x,y,z);
+      solver.update();
+
+      std::vector<size_t> safe = solver.safeCells();
+      for (size_t i=0; i<safe.size(); ++i) {
+	mf.cellPosition(safe[i], x, y, z);
+	mf.touch(x,y,z);
+      }
+      if (probability.compute()) {
+	++computed;
+	bad += probability.interiorCells() > cells;
+      }
+    }
+  }
+  check_failed |= (bad > 0);
+
+  std::cout << "stale solver " << n << "^3, " << mines << " mines, " << games << " games: "
+	    << computed << " computes, " << bad << " with more interior cells than the board"
+	    << (bad ? " (INTERIOR UNDERFLOWED)" : "") << "\n";
+}
+
+/*!
+  Plays the games benchProbability()'s second bot plays, and at each
+  guess runs compute() on the same position with the cache and without
+  it.  Reports how long each took on average, how long taking a
+  component from the cache took and how long counting one that wasn't
+  there did, and how many guesses the two didn't agree on.
+*/
+static void benchCache(size_t n, size_t games) {
+  int mines = int(n*n*n/8);
+  size_t guesses = 0, differed = 0, hits = 0, misses = 0;
+  double cached_time = 0.0, uncached_time = 0.0, hit_time = 0.0, miss_time = 0.0;
+  for (size_t g=0; g<games; ++g) {
+    Minefield mf(n, n, n, mines, g+1);
+    MinefieldSolver solver(mf);
+    MinefieldProbability cached(solver), uncached(solver);
+    uncached.setCaching(false);
+    Xoshiro256 rng(g+1);
+    while (!mf.hasWon()) {
+      size_t index = 0;
+      bool chosen = false;
+      if (mf.cellsOpened() > 0) {
+	double start = now();
+	bool exact = cached.compute();
+	cached_time += now() - start;
+	start = now();
+	bool same = (uncached.compute() == exact);
+	uncached_time += now() - start;
+	++guesses;
+
+	chosen = exact && cached.safestCell(index);
+	size_t other = 0;
+	if (chosen) {
+	  same = same && uncached.safestCell(other) && other == index;
+	}
+	differed += !same;
+      }
+      while (!chosen) {
+	index = mf.cellIndex(rng.below(n), rng.below(n), rng.below(n));
+	size_t x, y, z;
+	mf.cellPosition(index, x, y, z);
+	mf_state_t st = mf.getState(x,y,z);
+	chosen = (st == closed || st == closed_bomb) && !solver.isMine(index);
+      }
+
+      size_t x, y, z;
+      mf.cellPosition(index, x, y, z);
+      if (mf.getState(x,y,z) == closed_bomb) break;
+      mf.touch(x,y,z);
+      solver.update();
+      solver.openSafe();
+    }
+    hits += cached.cacheHits();
+    misses += cached.cacheMisses();
+    hit_time += cached.hitTime();
+    miss_time += cached.missTime();
+  }
+
+  std::cout << "cache " << n << "^3, " << games << " games, " << guesses << " guesses: compute() "
+	    << cached_time*1e6/guesses << " us with the cache, " << uncached_time*1e6/guesses
+	    << " us without; " << hits << " components from the cache in "
+	    << (hits ? hit_time*1e6/hits : 0.0) << " us each, " << misses << " counted in "
+	    << (misses ? miss_time*1e6/misses : 0.0) << " us each; " << differed << " differed\n";
+}
+
+/*!
+  Plays games on n^3 boards like the second bot in benchProbability(),
+  but when compute() goes over the limit, guesses the cell
+  MinefieldEstimator says is safest instead of a random one.  Reports
+  how many games it won, and how long estimate() took, how many
+  solutions it sampled, the margin of the cells it chose and how many
+  chains found a solution within the budget.
+*/
+static void benchEstimator(size_t n, size_t games, double budget) {
+  int mines = int(n*n*n/8);
+  size_t won = 0, guesses = 0, estimates = 0, failed = 0, samples = 0;
+  size_t chains = 0, started = 0;
+  double estimate_time = 0.0, margins = 0.0;
+  for (size_t g=0; g<games; ++g) {
+    Minefield mf(n, n, n, mines, g+1);
+    MinefieldSolver solver(mf);
+    MinefieldEstimator estimator(solver);
+    estimator.setBudget(budget);
+    estimator.setSeed(g+1);
+    Xoshiro256 rng(g+1);
+    while (!mf.hasWon()) {
+      size_t index = 0;
+      bool chosen = false;
+      if (mf.cellsOpened() > 0) {
+	++guesses;
+	chosen = estimator.compute() && estimator.safestCell(index);
+	if (!chosen) {
+	  double start = now();
+	  bool ok = estimator.estimate();
+	  estimate_time += now() - start;
+	  ++estimates;
+	  failed += !ok;
+	  samples += estimator.samples();
+	  chains += estimator.chainsRun();
+	  started += estimator.chainsStarted();
+	  chosen = ok && estimator.safestCell(index);
+	  if (chosen) {
+	    margins += estimator.margin(index);
+	  }
+	}
+      }
+      while (!chosen) {
+	index = mf.cellIndex(rng.below(n), rng.below(n), rng.below(n));
+	size_t x, y, z;
+	mf.cellPosition(index, x, y, z);
+	mf_state_t st = mf.getState(x,y,z);
+	chosen = (st == closed || st == closed_bomb) && !solver.isMine(index);
+      }
+
+      size_t x, y, z;
+      mf.cellPosition(index, x, y, z);
+      if (mf.getState(x,y,z) == closed_bomb) break;
+      mf.touch(x,y,z);
+      solver.update();
+      solver.openSafe();
+    }
+    won += mf.hasWon();
+  }
+
+  std::cout << "estimator " << n << "^3, " << games << " games: won " << won << ", "
+	    << estimates << " of " << guesses << " guesses estimated in "
+	    << (estimates ? estimate_time*1e3/estimates : 0.0) << " ms each, "
+	    << (estimates ? double(samples)/estimates : 0.0) << " samples, mean margin "
+	    << (estimates > failed ? margins/(estimates - failed) : 0.0) << ", "
+	    << started << " of " << chains << " chains found a solution, "
+	    << failed << " failed\n";
+}
+
+/*!
+  Opens cells of an n^3 board at random, as benchElimination() does,
+  until the frontier is too big for compute() to count, then runs
+  estimate() on it.  Reports how long it took and how many of the
+  chains found a solution within the budget.
+*/
+static void benchFrontierEstimate(size_t n, double budget) {
+  int mines = int(n*n*n/6);
+  Minefield mf(n, n, n, mines, 7);
+  MinefieldSolver solver(mf);
+  Xoshiro256 rng(9);
+  while (solver.frontier().size() < n*n*n/8 && mf.cellsOpened() < n*n*n/2) {
+    size_t x = rng.below(n), y = rng.below(n), z = rng.below(n);
+    if (mf.getState(x,y,z) == closed) {
+      mf.touch(x,y,z);
+      solver.update();
+    }
+  }
+
+  MinefieldEstimator estimator(solver);
+  estimator.setBudget(budget);
+  bool exact = estimator.compute();
+  double start = now();
+  bool ok = estimator.estimate();
+  double elapsed = now() - start;
+  std::cout << "estimator " << n << "^3 frontier: " << solver.frontier().size() << " constraints, "
+	    << (exact ? "counted" : "not counted") << ", estimate() "
+	    << (ok ? "succeeded" : "failed") << " in " << elapsed*1e3 << " ms with a budget of "
+	    << budget*1e3 << " ms, " << estimator.chainsStarted() << " of " << estimator.chainsRun()
+	    << " chains found a solution, " << estimator.samples() << " samples\n";
+}
+
+/*!
+  Finds the cells the renderer draws on an n^3 board with half its cells
+  opened, frame after frame: with getState() on every cell, as drawMine()
+  used to, and with runs(), on an unchanged board and on one that's
+  marked between frames.
+*/
+static void benchRuns(size_t n, size_t frames) {
+  int mines = int(n*n*n/10);
+  Minefield mf(n, n, n, mines, 1);
+  Xoshiro256 rng(1);
+  while (mf.cellsOpened() < (n*n*n-mines)/2) {
+    size_t x = rng.below(n), y = rng.below(n), z = rng.below(n);
+    if (mf.getState(x,y,z) == closed) {
+      mf.touch(x,y,z);
+    }
+  }
+
+  size_t looped = 0;
+  double start = now();
+  for (size_t f=0; f<frames; ++f) {
+    for (size_t i=0; i<n; ++i) {
+      for (size_t j=0; j<n; ++j) {
+	for (size_t k=0; k<n; ++k) {
+	  looped += (mf.getState(i,j,k) != open || mf.bombsNear(i,j,k) != 0);
+	}
+      }
+    }
+  }
+  double loop_time = now() - start;
+
+  size_t cached = 0;
+  start = now();
+  for (size_t f=0; f<frames; ++f) {
+    for (const mf_run_t &run : mf.runs(VISIBLE_RUNS)) {
+      cached += run.length;
+    }
+  }
+  double cached_time = now() - start;
+
+  size_t changed = 0;
+  start = now();
+  for (size_t f=0; f<frames; ++f) {
+    mf.mark(0,0,0);
+    for (const mf_run_t &run : mf.runs(VISIBLE_RUNS)) {
+      changed += run.length;
+    }
+  }
+  double changed_time = now() - start;
+
+  std::cout << "runs " << n << "^3: getState() loop " << loop_time*1e3/frames
+	    << " ms/frame, runs() " << cached_time*1e3/frames << " ms/frame, after a change "
+	    << changed_time*1e3/frames << " ms/frame (" << looped/frames << ", "
+	    << cached/frames << ", " << changed/frames << " cells)\n";
+}
+
+/*!
+  Has 1, 2, 4... 32 players make random moves on one concurrent n^3
+  board at the same time: they mark the bombs they pick and touch
+  everything else.  Checks that the counters match the board afterwards.
+*/
+static void benchConcurrent(size_t n, size_t moves) {
+  int mines = int(n*n*n/10);
+  for (unsigned players=1; players<=32; players*=2) {
+    Minefield mf(n, n, n, mines, 1);
+    mf.setConcurrent(true);
+    setWorkerThreads(players);
+
+    std::vector<size_t> opened(players, 0);
+    double start = now();
+    parallelFor(players, [&](size_t p, unsigned) {
+	Xoshiro256 rng(p+1);
+	for (size_t m=0; m<moves/players; ++m) {
+	  size_t x = rng.below(n), y = rng.below(n), z = rng.below(n);
+	  if (mf.getState(x,y,z) == closed_bomb) {
+	    mf.mark(x,y,z);
+	  } else {
+	    opened[p] += mf.touch(x,y,z);
+	  }
+	}
+      });
+    double elapsed = now() - start;
+
+    size_t total = 0, open_cells = 0, marks = 0;
+    for (unsigned p=0; p<players; ++p) {
+      total += opened[p];
+    }
+    for (size_t k=0; k<n; ++k) {
+      for (size_t j=0; j<n; ++j) {
+	for (size_t i=0; i<n; ++i) {
+	  mf_state_t st = mf.getState(i,j,k);
+	  open_cells += (st == open);
+	  marks += (st == marked_bomb || st == marked_empty);
+	}
+      }
+    }
+    bool exact = (total == open_cells && mf.cellsOpened() == open_cells
+		  && mf.minesRemaining() == mines-int(marks));
+    std::cout << "concurrent " << n << "^3, " << players << " players, " << moves << " moves: "
+	      << elapsed << " s, " << open_cells << " opened" << (exact ? "" : " (COUNTS DIFFER)") << "\n";
+  }
+  setWorkerThreads(0);
+}
+
+/*!
+  Plays games at one of the built in difficulty levels three ways: a new
+  Minefield for each game, one Minefield that's reset() for each game,
+  and a new Minefield for each game drawing on a MinefieldPool.  Reports
+  the time and the heap allocations per game, not counting a first game
+  to warm up.
+*/
+static void benchReuse(size_t n, int mines, size_t games) {
+  size_t opened = 0;
+
+  Minefield *warm = new Minefield(n, n, n, mines, 0);
+  opened += playOut(*warm);
+  delete warm;
+  size_t allocs = heap_allocations;
+  double start = now();
+  for (size_t g=1; g<=games; ++g) {
+    Minefield *mf = new Minefield(n, n, n, mines, g);
+    opened += playOut(*mf);
+    delete mf;
+  }
+  double new_time = now() - start;
+  size_t new_allocs = heap_allocations - allocs;
+
+  Minefield reused(n, n, n, mines, 0);
+  opened += playOut(reused);
+  allocs = heap_allocations;
+  start = now();
+  for (size_t g=1; g<=games; ++g) {
+    reused.reset(n, n, n, mines, g);
+    opened += playOut(reused);
+  }
+  double reset_time = now() - start;
+  size_t reset_allocs = heap_allocations - allocs;
+
+  MinefieldPool pool;
+  {
+    Minefield mf(n, n, n, mines, 0, row_major_layout, &pool);
+    opened += playOut(mf);
+  }
+  allocs = heap_allocations;
+  start = now();
+  for (size_t g=1; g<=games; ++g) {
+    Minefield mf(n, n, n, mines, g, row_major_layout, &pool);
+    opened += playOut(mf);
+  }
+  double pool_time = now() - start;
+  size_t pool_allocs = heap_allocations - allocs;
+
+  std::cout << "reuse " << n << "^3, " << games << " games (" << opened << " cells): new "
+	    << new_time*1e6/games << " us, " << double(new_allocs)/games << " allocs; reset "
+	    << reset_time*1e6/games << " us, " << double(reset_allocs)/games << " allocs; pool "
+	    << pool_time*1e6/games << " us, " << double(pool_allocs)/games << " allocs\n";
+}
+
+/*!
+  Usage: mfbench [benchmark] [size]
+  benchmark is one of all, generate, scaling, cascade, counts, layouts,
+  fixed, play, reuse, regions, neighborhoods, fork, solver, elimination,
+  probability, estimator, runs, concurrent or chunked.
+*/
+int main(int argc, char *argv[]) {
+  std::string which = argc > 1 ? argv[1] : "all";
+  size_t n = argc > 2 ? std::strtoul(argv[2], 0, 10) : 200;
+  bool all = (which == "all");
+
+  if (all || which == "generate") {
+    benchGenerate(n, 0.1);
+    benchGenerate(n, 0.5);
+    benchGenerate(n, 0.9);
+  }
+  if (all || which == "scaling") {
+    benchScaling(all ? 256 : n);
+  }
+  if (all || which == "cascade") {
+    benchCascade(15, 160);
+    std::vector<unsigned> counts = threadCounts();
+    for (size_t t=0; t<counts.size(); ++t) {
+      setWorkerThreads(counts[t]);
+      benchCascade(n, int(n*n*n/1000));
+    }
+    setWorkerThreads(0);
+  }
+  if (all || which == "counts") {
+    benchCounts(n, 5);
+  }
+  if (all || which == "layouts") {
+    setWorkerThreads(1);
+    benchLayouts(64);
+    benchLayouts(256);
+    if (n != 64 && n != 256) {
+      benchLayouts(n);
+    }
+    setWorkerThreads(0);
+  }
+  if (all || which == "fixed") {
+    benchFixed<6>(10, 100000);
+    benchFixed<11>(60, 20000);
+    benchFixed<15>(160, 10000);
+  }
+  if (all || which == "play") {
+    benchPlay(6, 10, 100000);
+    benchPlay(11, 60, 20000);
+    benchPlay(15, 160, 10000);
+    benchPlay(40, 2000, 500);
+  }
+  if (all || which == "reuse") {
+    benchReuse(6, 10, 100000);
+    benchReuse(11, 60, 20000);
+    benchReuse(15, 160, 10000);
+    benchReuse(40, 2000, 500);
+  }
+  if (all || which == "regions") {
+    benchRegions(64);
+    benchRegions(n);
+  }
+  if (all || which == "neighborhoods") {
+    benchNeighborhoods(15, 2000);
+    benchNeighborhoods(64, 20);
+  }
+  if (all || which == "fork") {
+    benchFork(15, 100000);
+    benchFork(64, 2000);
+  }
+  if (all || which == "solver") {
+    benchSolver(15, 200);
+    benchSolver(64, 2);
+  }
+  if (all || which == "elimination") {
+    benchElimination(15);
+    benchElimination(30);
+    benchElimination(50);
+  }
+  if (all || which == "probability") {
+    benchProbability(8, 200);
+    benchProbability(15, 20);
+    benchCache(8, 50);
+    benchCache(15, 10);
+    benchStaleSolver(20, 40, 20);
+  }
+  if (all || which == "estimator") {
+    benchEstimator(15, 20, 0.05);
+    benchEstimator(30, 2, 0.2);
+    benchFrontierEstimate(30, 0.5);
+    benchFrontierEstimate(50, 0.5);
+  }
+  if (all || which == "runs") {
+    benchRuns(15, 10000);
+    benchRuns(64, 100);
+  }
+  if (all || which == "concurrent") {
+    benchConcurrent(n, 1000000);
+  }
+  if (all || which == "chunked") {
+    benchChunked(1000000, 0.09);
+  }
+  return check_failed ? 1 : 0;
+}
@@ -0,0 +1,214 @@
+/*
+  bombcount.cpp
+ 
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MF_AVX2_DISPATCH
+#include <immintrin.h>
+#endif
+
+#include "bombcount.h"
+
+/*
+  The 3x3x3 box sum is separable, so it's done as three passes of 1D
+  three-tap sums: along x within a row, then along y between rows, then
+  along z between planes.  The y and z passes are plain adds of three
+  arrays, and the x pass is an add of three shifted copies of a row, so
+  all of them vectorise.  The largest possible count is 27, so bytes
+  never overflow.
+*/
+
+/*!
+  Scalar version of the x pass: out[i] = in[i-1]+in[i]+in[i+1]
+*/
+static void sumRowScalar(const unsigned char *in, unsigned char *out, size_t n) {
+  for (size_t i=1; i+1<n; ++i) {
+    out[i] = in[i-1] + in[i] + in[i+1];
+  }
+}
+
+/*!
+  Scalar version of the y and z passes: out[i] = a[i]+b[i]+c[i]
+*/
+static void addRowsScalar(const unsigned char *a, const unsigned char *b,
+			  const unsigned char *c, unsigned char *out, size_t n) {
+  for (size_t i=0; i<n; ++i) {
+    out[i] = a[i] + b[i] + c[i];
+  }
+}
+
+#ifdef MF_AVX2_DISPATCH
+/*!
+  AVX2 version of the x pass
+*/
+__attribute__((target("avx2")))
+static void sumRowAVX2(const unsigned char *in, unsigned char *out, size_t n) {
+  size_t i = 1;
+  for (; i+32 < n; i += 32) {
+    __m256i l = _mm256_loadu_si256((const __m256i*)(in+i-1));
+    __m256i c = _mm256_loadu_si256((const __m256i*)(in+i));
+    __m256i r = _mm256_loadu_si256((const __m256i*)(in+i+1));
+    _mm256_storeu_si256((__m256i*)(out+i),
+			_mm256_add_epi8(_mm256_add_epi8(l, c), r));
+  }
+  for (; i+1<n; ++i) {
+    out[i] = in[i-1] + in[i] + in[i+1];
+  }
+}
+
+/*!
+  AVX2 version of the y and z passes
+*/
+__attribute__((target("avx2")))
+static void addRowsAVX2(const unsigned char *a, const unsigned char *b,
+			const unsigned char *c, unsigned char *out, size_t n) {
+  size_t i = 0;
+  for (; i+32 <= n; i += 32) {
+    __m256i va = _mm256_loadu_si256((const __m256i*)(a+i));
+    __m256i vb = _mm256_loadu_si256((const __m256i*)(b+i));
+    __m256i vc = _mm256_loadu_si256((const __m256i*)(c+i));
+    _mm256_storeu_si256((__m256i*)(out+i),
+			_mm256_add_epi8(_mm256_add_epi8(va, vb), vc));
+  }
+  for (; i<n; ++i) {
+    out[i] = a[i] + b[i] + c[i];
+  }
+}
+#endif
+
+typedef void (*sum_row_fn)(const unsigned char*, unsigned char*, size_t);
+typedef void (*add_rows_fn)(const unsigned char*, const unsigned char*,
+			    const unsigned char*, unsigned char*, size_t);
+
+/*!
+  Returns true if the CPU supports AVX2.  The answer is cached.
+*/
+static bool haveAVX2() {
+#ifdef MF_AVX2_DISPATCH
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+#else
+  return false;
+#endif
+}
+
+/*!
+  Returns the name of the row kernel in use
+*/
+const char *bombCountKernel() {
+  return haveAVX2() ? "avx2" : "scalar";
+}
+
+/*!
+  Sums a row along x into out, including the clamped ends.
+*/
+static void sumRow(sum_row_fn sum_row, const unsigned char *in,
+		   unsigned char *out, size_t w) {
+  if (w==1) {
+    out[0] = in[0];
+    return;
+  }
+  sum_row(in, out, w);
+  out[0] = in[0] + in[1];
+  out[w-1] = in[w-2] + in[w-1];
+}
+
+/*!
+  Computes the x and y sums of one w*h plane into out.
+  x_sums is scratch space for the x pass, and zeros is a row of zeros
+  that stands in for the missing rows at the edges.
+*/
+static void sumPlane(sum_row_fn sum_row, add_rows_fn add_rows,
+		     const unsigned char *in, unsigned char *x_sums,
+		     const unsigned char *zeros, unsigned char *out,
+		     size_t w, size_t h) {
+  for (size_t j=0; j<h; ++j) {
+    sumRow(sum_row, in+j*w, x_sums+j*w, w);
+  }
+  for (size_t j=0; j<h; ++j) {
+    const unsigned char *prev = (j>0) ? x_sums+(j-1)*w : zeros;
+    const unsigned char *next = (j+1<h) ? x_sums+(j+1)*w : zeros;
+    add_rows(prev, x_sums+j*w, next, out+j*w, w);
+  }
+}
+
+/*!
+  countBombsNearPlanes() runs the three passes a plane at a time.
+  xy_sums holds the x and y sums of the planes before, at, and after the
+  one being written, so the z pass can overwrite the input in place:
+  plane z's input has already been consumed by the time its output is
+  written.  below and above are copies of the input planes just outside
+  the range, or null at the edges of the board.
+*/
+void countBombsNearPlanes(unsigned char *cells, size_t w, size_t h,
+			  size_t z0, size_t z1,
+			  const unsigned char *below, const unsigned char *above) {
+  sum_row_fn sum_row = sumRowScalar;
+  add_rows_fn add_rows = addRowsScalar;
+#ifdef MF_AVX2_DISPATCH
+  if (haveAVX2()) {
+    sum_row = sumRowAVX2;
+    add_rows = addRowsAVX2;
+  }
+#endif
+
+  size_t plane = w*h;
+  if (plane==0 || z0>=z1) return;
+
+  // One plane of x sums, three planes of xy sums, and a plane of zeros
+  // for the missing neighbors at the edges.  It's kept for the thread's
+  // next call, so counting board after board doesn't allocate.
+  static thread_local std::vector<unsigned char> scratch;
+  scratch.assign(5*plane, 0);
+  unsigned char *x_sums = &scratch[0];
+  unsigned char *xy_sums[3] = {&scratch[plane], &scratch[2*plane], &scratch[3*plane]};
+  const unsigned char *zeros = &scratch[4*plane];
+
+  if (below) {
+    sumPlane(sum_row, add_rows, below, x_sums, zeros, xy_sums[0], w, h);
+  }
+  sumPlane(sum_row, add_rows, cells+z0*plane, x_sums, zeros, xy_sums[1], w, h);
+  for (size_t k=z0; k<z1; ++k) {
+    // xy_sums[0] is plane k-1, [1] is plane k, [2] is plane k+1
+    const unsigned char *prev = (k>z0 || below) ? xy_sums[0] : zeros;
+    const unsigned char *next_in = (k+1<z1) ? cells+(k+1)*plane : above;
+    const unsigned char *next = zeros;
+    if (next_in) {
+      sumPlane(sum_row, add_rows, next_in, x_sums, zeros, xy_sums[2], w, h);
+      next = xy_sums[2];
+    }
+    add_rows(prev, xy_sums[1], next, cells+k*plane, plane);
+
+    // Slide the window along z
+    unsigned char *oldest = xy_sums[0];
+    xy_sums[0] = xy_sums[1];
+    xy_sums[1] = xy_sums[2];
+    xy_sums[2] = oldest;
+  }
+}
+
+/*!
+  Counts the whole board in one go
+*/
+void countBombsNear(unsigned char *cells, size_t w, size_t h, size_t d) {
+  countBombsNearPlanes(cells, w, h, 0, d, 0, 0);
+}
@@ -0,0 +1,43 @@
+/*
+  bombcount.h
+ 
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BOMBCOUNT_H
+#define BOMBCOUNT_H
+
+#include <cstddef>
+
+// Replaces a w*h*d row major array of 0/1 bomb flags with the number of
+// bombs in the 3x3x3 block around each cell (clamped at the edges).
+// The work is done in place, a plane at a time.
+void countBombsNear(unsigned char *cells, size_t w, size_t h, size_t d);
+
+// Does the same for planes [z0, z1) only, so slabs of a board can be
+// counted in parallel.  below and above must be copies of the input
+// planes z0-1 and z1 (or null if they're off the board), because the
+// neighboring slabs overwrite them.
+void countBombsNearPlanes(unsigned char *cells, size_t w, size_t h,
+			  size_t z0, size_t z1,
+			  const unsigned char *below, const unsigned char *above);
+
+// Returns the name of the row kernel countBombsNear() uses on this machine
+const char *bombCountKernel();
+
+#endif
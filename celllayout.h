@@ -0,0 +1,267 @@
+/*
+  celllayout.h
+ 
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CELLLAYOUT_H
+#define CELLLAYOUT_H
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/*
+  A cell layout decides where each cell of a w*h*d board lives in
+  Minefield's arrays.  Each position in the arrays is a "slot".  Every
+  layout surrounds the board with a border at least one cell thick, so
+  all 26 neighbors of a cell have slots, and every layout provides:
+
+    resize(w,h,d)      sets the board size
+    slots()            size of the arrays
+    slot(x,y,z)        slot of a cell
+    position(s,x,y,z)  cell at a slot inside the board
+    neighbor(s,k)      slot of neighbor k (0-25) of slot s
+    forEachNeighbor(s,f)  calls f(n) with the slot of each neighbor, in order
+
+  Neighbors are numbered with x changing fastest, then y, then z, from
+  (-1,-1,-1) to (1,1,1), skipping the cell itself.  Minefield's loops are
+  templates over the layout, so these all inline.
+*/
+
+// The layouts Minefield can use
+enum mf_layout_t {row_major_layout, bricked_layout};
+
+/*!
+  PaddedLayout stores the board row major (x fastest, then y, then z)
+  with a one cell border, so neighbors are fixed offsets and each row of
+  the board is contiguous.
+*/
+class PaddedLayout {
+ public:
+  PaddedLayout() { resize(0,0,0); }
+
+  void resize(size_t w, size_t h, size_t d) {
+    pad_w = w+2;
+    pad_h = h+2;
+    pad_d = d+2;
+    size_t k = 0;
+    for (int zinc = -1; zinc <= 1; zinc += 1) {
+      for (int yinc = -1; yinc <= 1; yinc += 1) {
+	for (int xinc = -1; xinc <= 1; xinc += 1) {
+	  if (xinc != 0 || yinc != 0 || zinc != 0) {
+	    offsets[k++] = xinc + ptrdiff_t(pad_w)*(yinc + ptrdiff_t(pad_h)*zinc);
+	  }
+	}
+      }
+    }
+  }
+
+  size_t slots() const { return pad_w*pad_h*pad_d; }
+
+  size_t slot(size_t x, size_t y, size_t z) const {
+    return (x+1) + pad_w*((y+1) + pad_h*(z+1));
+  }
+
+  void position(size_t s, size_t &x, size_t &y, size_t &z) const {
+    x = s % pad_w - 1;
+    s /= pad_w;
+    y = s % pad_h - 1;
+    z = s / pad_h - 1;
+  }
+
+  size_t neighbor(size_t s, size_t k) const { return s + offsets[k]; }
+
+  template <class F>
+  void forEachNeighbor(size_t s, F f) const {
+    for (size_t k=0; k<26; ++k) {
+      f(s + offsets[k]);
+    }
+  }
+
+  // Size of the padded board
+  size_t paddedWidth() const { return pad_w; }
+  size_t paddedHeight() const { return pad_h; }
+  size_t paddedDepth() const { return pad_d; }
+
+ private:
+  size_t pad_w;
+  size_t pad_h;
+  size_t pad_d;
+
+  // Offsets from a slot to its 26 neighbors
+  ptrdiff_t offsets[26];
+};
+
+/*!
+  BrickedLayout stores the (padded) board as 4x4x4 bricks of 64 cells,
+  one cache line each, with the cells of a brick in Z order (Morton
+  order) and the bricks row major.  A cell and its 26 neighbors span at
+  most 8 bricks, and usually 1 or 2, instead of 9 rows spread over three
+  planes, so neighbor loops on big boards touch far fewer cache lines.
+
+  A plain Morton order over the whole board would need the board rounded
+  up to a power of two on each axis, up to 8x the memory; bricks only
+  round up to a multiple of 4.
+
+  A neighbor's slot depends on where the cell sits in its brick, so
+  neighbor() looks the offset up in a table indexed by the cell's
+  position in the brick (the low 6 bits of the slot).  The table is
+  about 13 KB, so it's shared by every copy of the layout, and an empty
+  layout, as Minefield keeps when it isn't bricked, has none.
+*/
+class BrickedLayout {
+ public:
+  BrickedLayout() { resize(0,0,0); }
+
+  void resize(size_t w, size_t h, size_t d) {
+    // Room for the border, rounded up to whole bricks
+    bricks_x = (w+2+3)/4;
+    bricks_y = (h+2+3)/4;
+    bricks_z = (d+2+3)/4;
+    if (w == 0 && h == 0 && d == 0) {
+      steps.reset();
+      return;
+    }
+
+    // The table is rebuilt in place unless a copy is still using it
+    if (!steps || steps.use_count() > 1) {
+      steps = std::make_shared<StepTable>();
+    }
+    StepTable *table = steps.get();
+    for (size_t local=0; local<64; ++local) {
+      int lx = int(localX(local)), ly = int(localY(local)), lz = int(localZ(local));
+      size_t k = 0;
+      for (int zinc = -1; zinc <= 1; zinc += 1) {
+	for (int yinc = -1; yinc <= 1; yinc += 1) {
+	  for (int xinc = -1; xinc <= 1; xinc += 1) {
+	    if (xinc == 0 && yinc == 0 && zinc == 0) continue;
+	    // Position in the neighboring brick, and which brick that is
+	    int nx = lx+xinc, ny = ly+yinc, nz = lz+zinc;
+	    int bx = (nx < 0) ? -1 : (nx > 3) ? 1 : 0;
+	    int by = (ny < 0) ? -1 : (ny > 3) ? 1 : 0;
+	    int bz = (nz < 0) ? -1 : (nz > 3) ? 1 : 0;
+	    ptrdiff_t brick = bx + ptrdiff_t(bricks_x)*(by + ptrdiff_t(bricks_y)*bz);
+	    ptrdiff_t target = localSlot(size_t(nx & 3), size_t(ny & 3), size_t(nz & 3));
+	    table->step[local][k++] = brick*64 + target - ptrdiff_t(local);
+	  }
+	}
+      }
+    }
+  }
+
+  size_t slots() const { return bricks_x*bricks_y*bricks_z*64; }
+
+  size_t slot(size_t x, size_t y, size_t z) const {
+    size_t px = x+1, py = y+1, pz = z+1;
+    size_t brick = ((pz >> 2)*bricks_y + (py >> 2))*bricks_x + (px >> 2);
+    return (brick << 6) | localSlot(px & 3, py & 3, pz & 3);
+  }
+
+  void position(size_t s, size_t &x, size_t &y, size_t &z) const {
+    size_t local = s & 63;
+    size_t brick = s >> 6;
+    x = (brick % bricks_x)*4 + localX(local) - 1;
+    brick /= bricks_x;
+    y = (brick % bricks_y)*4 + localY(local) - 1;
+    z = (brick / bricks_y)*4 + localZ(local) - 1;
+  }
+
+  size_t neighbor(size_t s, size_t k) const { return s + steps->step[s & 63][k]; }
+
+  template <class F>
+  void forEachNeighbor(size_t s, F f) const {
+    const ptrdiff_t *step = steps->step[s & 63];
+    for (size_t k=0; k<26; ++k) {
+      f(s + step[k]);
+    }
+  }
+
+ private:
+  // Z order within a brick interleaves the coordinates' two bits as
+  // x0 y0 z0 x1 y1 z1, lowest first
+  static size_t spread(size_t v) { return (v & 1) | ((v & 2) << 2); }
+  static size_t localSlot(size_t x, size_t y, size_t z) {
+    return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+  }
+  static size_t localX(size_t local) { return (local & 1) | ((local >> 2) & 2); }
+  static size_t localY(size_t local) { return ((local >> 1) & 1) | ((local >> 3) & 2); }
+  static size_t localZ(size_t local) { return ((local >> 2) & 1) | ((local >> 4) & 2); }
+
+  size_t bricks_x;
+  size_t bricks_y;
+  size_t bricks_z;
+
+  // Offset to each of the 26 neighbors, for each position in a brick
+  struct StepTable {
+    ptrdiff_t step[64][26];
+  };
+  std::shared_ptr<StepTable> steps;
+};
+
+/*!
+  FixedPaddedLayout is PaddedLayout with the board size fixed at compile
+  time, for the built in difficulty levels.  Everything is static and
+  constexpr, so slots come from constant multiplies, the neighbor offsets
+  are immediates, and forEachNeighbor() is fully unrolled.  It holds no
+  data, so making one costs nothing.
+*/
+template <size_t W, size_t H, size_t D>
+class FixedPaddedLayout {
+ public:
+  static const size_t PAD_W = W+2;
+  static const size_t PAD_H = H+2;
+  static const size_t PAD_D = D+2;
+  static const size_t SLOTS = PAD_W*PAD_H*PAD_D;
+
+  static constexpr size_t slots() { return SLOTS; }
+
+  static constexpr size_t slot(size_t x, size_t y, size_t z) {
+    return (x+1) + PAD_W*((y+1) + PAD_H*(z+1));
+  }
+
+  static void position(size_t s, size_t &x, size_t &y, size_t &z) {
+    x = s % PAD_W - 1;
+    s /= PAD_W;
+    y = s % PAD_H - 1;
+    z = s / PAD_H - 1;
+  }
+
+  // Offset to neighbor k, skipping the cell itself in the middle
+  static constexpr ptrdiff_t offset(size_t k) {
+    return ptrdiff_t((k < 13 ? k : k+1) % 3) - 1
+      + ptrdiff_t(PAD_W)*(ptrdiff_t((k < 13 ? k : k+1) / 3 % 3) - 1)
+      + ptrdiff_t(PAD_W*PAD_H)*(ptrdiff_t((k < 13 ? k : k+1) / 9) - 1);
+  }
+
+  static size_t neighbor(size_t s, size_t k) { return s + offset(k); }
+
+  template <class F>
+  static void forEachNeighbor(size_t s, F f) {
+    unrolled(s, f, std::make_index_sequence<26>());
+  }
+
+ private:
+  template <class F, size_t... K>
+  static void unrolled(size_t s, F &f, std::index_sequence<K...>) {
+    int expand[] = {(f(s + offset(K)), 0)...};
+    (void)expand;
+  }
+};
+
+#endif
@@ -0,0 +1,360 @@
+/*
+  chunkedminefield.cpp
+ 
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "chunkedminefield.h"
+#include "bombcount.h"
+#include "minefieldcells.h"
+#include "rng.h"
+
+static const size_t CHUNK_MASK=CHUNK_SIZE-1;
+
+/*!
+  Packs chunk coordinates into a single key
+*/
+static uint64_t chunkKey(size_t cx, size_t cy, size_t cz) {
+  return (uint64_t(cz) << 42) | (uint64_t(cy) << 21) | uint64_t(cx);
+}
+
+/*!
+  Packs cell coordinates into a single value for the flood fill queue
+*/
+static uint64_t packCell(size_t x, size_t y, size_t z) {
+  return (uint64_t(z) << 42) | (uint64_t(y) << 21) | uint64_t(x);
+}
+
+/*!
+  Number of cells along an axis of length dim in chunk c
+*/
+static size_t chunkSpan(size_t dim, size_t c) {
+  size_t start = c*CHUNK_SIZE;
+  if (start >= dim) return 0;
+  return (dim-start < CHUNK_SIZE) ? dim-start : CHUNK_SIZE;
+}
+
+/*!
+  Converts the n'th cell of a partial chunk with rows sx long and planes
+  sy rows high to its bit in a full chunk
+*/
+static size_t chunkBit(size_t n, size_t sx, size_t sy) {
+  size_t x = n % sx, y = (n / sx) % sy, z = n / (sx*sy);
+  return (z*CHUNK_SIZE + y)*CHUNK_SIZE + x;
+}
+
+/*!
+  The constructor doesn't allocate any chunks.  It only works out how
+  many bombs the whole board has, which depends on nothing but the chunk
+  sizes: every axis has some full chunks and at most one partial one.
+*/
+ChunkedMinefield::ChunkedMinefield(const size_t w, const size_t h, const size_t d,
+				   const double density, const uint64_t sd):
+  wdth(w), hght(h), dpth(d), dnsty(density), seed(sd),
+  last_key(~uint64_t(0)), last_chunk(0),
+  num_bombs(0), num_cleared(0), total_cells(uint64_t(w)*h*d),
+  fake_marks(0), real_marks(0) {
+
+  if (w==0 || h==0 || d==0 ||
+      w>CHUNKED_MAX_DIM || h>CHUNKED_MAX_DIM || d>CHUNKED_MAX_DIM) {
+    throw std::runtime_error("Invalid size");
+  }
+  if (density < 0.0 || density > 1.0) {
+    throw std::runtime_error("Invalid density");
+  }
+
+  size_t dims[3] = {w, h, d};
+  size_t spans[3][2];
+  size_t counts[3][2];
+  for (size_t a=0; a<3; ++a) {
+    spans[a][0] = CHUNK_SIZE;
+    counts[a][0] = dims[a] / CHUNK_SIZE;
+    spans[a][1] = dims[a] % CHUNK_SIZE;
+    counts[a][1] = (spans[a][1] != 0);
+  }
+  for (size_t i=0; i<2; ++i) {
+    for (size_t j=0; j<2; ++j) {
+      for (size_t k=0; k<2; ++k) {
+	uint64_t n = uint64_t(counts[0][i])*counts[1][j]*counts[2][k];
+	size_t cells = spans[0][i]*spans[1][j]*spans[2][k];
+	num_bombs += n * uint64_t(std::floor(dnsty*cells + 0.5));
+      }
+    }
+  }
+}
+
+/*!
+  Frees all allocated chunks
+*/
+ChunkedMinefield::~ChunkedMinefield() {
+  for (std::unordered_map<uint64_t, Chunk*>::iterator it = chunks.begin();
+       it != chunks.end(); ++it) {
+    delete it->second;
+  }
+}
+
+/*!
+  Number of cells of the chunk that lie inside the board
+*/
+size_t ChunkedMinefield::chunkCells(size_t cx, size_t cy, size_t cz) const {
+  return chunkSpan(wdth,cx) * chunkSpan(hght,cy) * chunkSpan(dpth,cz);
+}
+
+/*!
+  Number of bombs placed in the chunk
+*/
+size_t ChunkedMinefield::chunkBombCount(size_t cx, size_t cy, size_t cz) const {
+  return size_t(std::floor(dnsty*chunkCells(cx,cy,cz) + 0.5));
+}
+
+/*!
+  placeBombs() fills in the bomb bitmap for a chunk.  The generator is
+  seeded from the board seed and the chunk coordinates only, so the same
+  chunk always gets the same bombs.  Floyd's algorithm picks exactly the
+  right number of distinct cells without retrying.
+  Chunks outside the board have no bombs.
+*/
+void ChunkedMinefield::placeBombs(size_t cx, size_t cy, size_t cz,
+				  ChunkBombs &bombs) const {
+  std::memset(bombs.bits, 0, sizeof(bombs.bits));
+
+  size_t sx = chunkSpan(wdth,cx);
+  size_t sy = chunkSpan(hght,cy);
+  size_t sz = chunkSpan(dpth,cz);
+  size_t cells = sx*sy*sz;
+  size_t n = chunkBombCount(cx,cy,cz);
+  if (n == 0) return;
+
+  uint64_t rng = seed ^ (chunkKey(cx,cy,cz) * 0xd1b54a32d192ed03ULL);
+  splitmix64(rng);
+
+  // Floyd's algorithm over the chunk's cells inside the board,
+  // numbered x fastest within the (possibly partial) chunk
+  for (size_t j=cells-n; j<cells; ++j) {
+    size_t bit = chunkBit(size_t(((splitmix64(rng) >> 32) * (j+1)) >> 32), sx, sy);
+    if (bombs.bits[bit/64] & (uint64_t(1) << (bit%64))) {
+      bit = chunkBit(j, sx, sy);
+    }
+    bombs.bits[bit/64] |= uint64_t(1) << (bit%64);
+  }
+}
+
+/*!
+  createChunk() allocates a chunk, sets up its cells from its bombs, and
+  counts bombs near each cell.  The counts need the bombs of the 26
+  neighboring chunks along the shared faces, so those are regenerated
+  (but not allocated) into an 18x18x18 block of 0/1 flags, which
+  countBombsNear() then box-sums.
+*/
+ChunkedMinefield::Chunk *ChunkedMinefield::createChunk(size_t cx, size_t cy, size_t cz) {
+  static const size_t PAD = CHUNK_SIZE+2;
+  Chunk *chunk = new Chunk;
+
+  ChunkBombs bombs;
+  placeBombs(cx,cy,cz,bombs);
+  for (size_t i=0; i<CHUNK_CELLS; ++i) {
+    chunk->cells[i] = (bombs.bits[i/64] & (uint64_t(1) << (i%64))) ? closed_bomb : closed;
+  }
+
+  unsigned char flags[PAD*PAD*PAD];
+  std::memset(flags, 0, sizeof(flags));
+  size_t last_cx = (wdth-1) >> CHUNK_BITS;
+  size_t last_cy = (hght-1) >> CHUNK_BITS;
+  size_t last_cz = (dpth-1) >> CHUNK_BITS;
+  for (int dz=-1; dz<=1; ++dz) {
+    for (int dy=-1; dy<=1; ++dy) {
+      for (int dx=-1; dx<=1; ++dx) {
+	// Off the board below zero wraps to a huge chunk index
+	size_t ncx = cx+dx, ncy = cy+dy, ncz = cz+dz;
+	if (ncx > last_cx || ncy > last_cy || ncz > last_cz) continue;
+	placeBombs(ncx,ncy,ncz,bombs);
+
+	// Copy the slab of the neighbor that touches this chunk:
+	// its last layer for -1, all of it for 0, its first layer for +1
+	size_t i_lo = (dx<0) ? CHUNK_SIZE-1 : 0, i_hi = (dx>0) ? 1 : CHUNK_SIZE;
+	size_t j_lo = (dy<0) ? CHUNK_SIZE-1 : 0, j_hi = (dy>0) ? 1 : CHUNK_SIZE;
+	size_t k_lo = (dz<0) ? CHUNK_SIZE-1 : 0, k_hi = (dz>0) ? 1 : CHUNK_SIZE;
+	for (size_t k=k_lo; k<k_hi; ++k) {
+	  size_t pz = k + 1 + dz*long(CHUNK_SIZE);
+	  for (size_t j=j_lo; j<j_hi; ++j) {
+	    size_t py = j + 1 + dy*long(CHUNK_SIZE);
+	    for (size_t i=i_lo; i<i_hi; ++i) {
+	      size_t px = i + 1 + dx*long(CHUNK_SIZE);
+	      size_t bit = (k*CHUNK_SIZE + j)*CHUNK_SIZE + i;
+	      if (bombs.bits[bit/64] & (uint64_t(1) << (bit%64))) {
+		flags[(pz*PAD + py)*PAD + px] = 1;
+	      }
+	    }
+	  }
+	}
+      }
+    }
+  }
+
+  countBombsNear(flags, PAD, PAD, PAD);
+  for (size_t k=0; k<CHUNK_SIZE; ++k) {
+    for (size_t j=0; j<CHUNK_SIZE; ++j) {
+      std::memcpy(&chunk->near_bombs[(k*CHUNK_SIZE + j)*CHUNK_SIZE],
+		  &flags[((k+1)*PAD + j+1)*PAD + 1], CHUNK_SIZE);
+    }
+  }
+
+  chunks[chunkKey(cx,cy,cz)] = chunk;
+  return chunk;
+}
+
+/*!
+  Returns the chunk containing cell (x,y,z), allocating it on first use.
+*/
+ChunkedMinefield::Chunk &ChunkedMinefield::chunkAt(size_t x, size_t y, size_t z) {
+  size_t cx = x >> CHUNK_BITS, cy = y >> CHUNK_BITS, cz = z >> CHUNK_BITS;
+  uint64_t key = chunkKey(cx,cy,cz);
+  if (key == last_key) return *last_chunk;
+
+  std::unordered_map<uint64_t, Chunk*>::iterator it = chunks.find(key);
+  last_chunk = (it != chunks.end()) ? it->second : createChunk(cx,cy,cz);
+  last_key = key;
+  return *last_chunk;
+}
+
+/*!
+  state() is used to access individual cells.  Like Minefield::state()
+  it checks the index, and it allocates the cell's chunk if needed.
+*/
+mf_cell_t &ChunkedMinefield::state(const size_t x, const size_t y, const size_t z) {
+  if (x>=wdth || y>=hght || z>=dpth) {
+    throw std::runtime_error("Invalid index");
+  }
+  return chunkAt(x,y,z).cells[((z & CHUNK_MASK)*CHUNK_SIZE + (y & CHUNK_MASK))*CHUNK_SIZE
+			      + (x & CHUNK_MASK)];
+}
+
+/*!
+  Returns the current state of the given cell.
+  Reading a cell in a chunk that hasn't been allocated regenerates the
+  chunk's bombs instead of allocating it.
+*/
+mf_state_t ChunkedMinefield::getState(const size_t x, const size_t y, const size_t z) {
+  if (x>=wdth || y>=hght || z>=dpth) {
+    throw std::runtime_error("Invalid index");
+  }
+  size_t cx = x >> CHUNK_BITS, cy = y >> CHUNK_BITS, cz = z >> CHUNK_BITS;
+  if (chunks.find(chunkKey(cx,cy,cz)) != chunks.end()) {
+    return mf_state_t(state(x,y,z));
+  }
+
+  ChunkBombs bombs;
+  placeBombs(cx,cy,cz,bombs);
+  size_t bit = ((z & CHUNK_MASK)*CHUNK_SIZE + (y & CHUNK_MASK))*CHUNK_SIZE + (x & CHUNK_MASK);
+  return (bombs.bits[bit/64] & (uint64_t(1) << (bit%64))) ? closed_bomb : closed;
+}
+
+/*!
+  Returns the number of bombs near the given cell.
+*/
+size_t ChunkedMinefield::bombsNear(const size_t x, const size_t y, const size_t z) {
+  if (x>=wdth || y>=hght || z>=dpth) {
+    throw std::runtime_error("Invalid index");
+  }
+  return chunkAt(x,y,z).near_bombs[((z & CHUNK_MASK)*CHUNK_SIZE + (y & CHUNK_MASK))*CHUNK_SIZE
+				   + (x & CHUNK_MASK)];
+}
+
+/*!
+  Returns the number of mines remaining.
+*/
+int64_t ChunkedMinefield::minesRemaining() {
+  return int64_t(num_bombs) - int64_t(fake_marks+real_marks);
+}
+
+/*!
+  Returns the memory used by the allocated chunks
+*/
+size_t ChunkedMinefield::chunkBytes() const {
+  return chunks.size() * sizeof(Chunk);
+}
+
+/*!
+  hasWon() returns true when every empty cell has been opened.
+*/
+bool ChunkedMinefield::hasWon() {
+  return num_cleared == (total_cells-num_bombs);
+}
+
+/*!
+  touch() opens a cell and, if it has no bombs near it, floods out to its
+  neighbors exactly like Minefield::touch().  The flood fill allocates
+  chunks as it reaches them.
+  The function returns number of opened cells.
+*/
+size_t ChunkedMinefield::touch(const size_t x, const size_t y, const size_t z) {
+  if (state(x,y,z) != closed) return 0;
+
+  state(x,y,z) = open;
+  touch_queue.clear();
+  touch_queue.push_back(packCell(x,y,z));
+
+  static const uint64_t COORD_MASK = CHUNKED_MAX_DIM-1;
+  for (size_t head = 0; head < touch_queue.size(); ++head) {
+    uint64_t packed = touch_queue[head];
+    size_t cx = packed & COORD_MASK;
+    size_t cy = (packed >> 21) & COORD_MASK;
+    size_t cz = packed >> 42;
+
+    // Only empty cells spread to their neighbors
+    if (bombsNear(cx,cy,cz) != 0) continue;
+
+    for (int zinc = -1; zinc <= 1; zinc += 1) {
+      for (int yinc = -1; yinc <= 1; yinc += 1) {
+	for (int xinc = -1; xinc <= 1; xinc += 1) {
+	  size_t nx = cx + xinc;
+	  size_t ny = cy + yinc;
+	  size_t nz = cz + zinc;
+
+	  if ((nx < wdth) &&
+	      (ny < hght) &&
+	      (nz < dpth)) {
+	    mf_cell_t &cell = state(nx,ny,nz);
+	    if (cell == closed) {
+	      cell = open;
+	      touch_queue.push_back(packCell(nx,ny,nz));
+	    }
+	  }
+	}
+      }
+    }
+  }
+
+  num_cleared += touch_queue.size();
+  return touch_queue.size();
+}
+
+/*!
+  mark() marks a cell as a bomb, or clears an existing mark
+*/
+void ChunkedMinefield::mark(const size_t x, const size_t y, const size_t z) {
+  mf_cell_t &cs = state(x,y,z);
+  mf_mark_change_t change = markChange(cs);
+  cs = change.after;
+  fake_marks += change.fake;
+  real_marks += change.real;
+}
@@ -0,0 +1,147 @@
+/*
+  chunkedminefield.h
+ 
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHUNKEDMINEFIELD_H
+#define CHUNKEDMINEFIELD_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "minefield.h"
+
+// Chunks are CHUNK_SIZE cells on a side
+static const size_t CHUNK_BITS=4;
+static const size_t CHUNK_SIZE=1<<CHUNK_BITS;
+static const size_t CHUNK_CELLS=CHUNK_SIZE*CHUNK_SIZE*CHUNK_SIZE;
+
+// Largest supported size along each axis
+static const size_t CHUNKED_MAX_DIM=size_t(1)<<21;
+
+/*!
+  ChunkedMinefield plays the same game as Minefield, but stores the board
+  in 16x16x16 chunks that are only allocated when something in them is
+  touched, marked or counted.  Each chunk's mines are placed from a hash
+  of its coordinates and the seed, so a chunk can be (re)generated at any
+  time without looking at the rest of the board, and a huge board only
+  costs memory for the parts that have been played.
+
+  Instead of an exact mine count it takes a density; every chunk gets
+  round(density * cells in chunk) mines.
+*/
+class ChunkedMinefield {
+ public:
+
+  ChunkedMinefield(const size_t w, const size_t h, const size_t d,
+		   const double density, const uint64_t seed);
+
+  ~ChunkedMinefield();
+
+  // The chunks are owned through raw pointers, so a copy would free
+  // them twice
+  ChunkedMinefield(const ChunkedMinefield &) = delete;
+  ChunkedMinefield &operator=(const ChunkedMinefield &) = delete;
+
+  // touch is called when a cell is clicked on.
+  size_t touch(const size_t x, const size_t y, const size_t z);
+
+  // Returns the state of a cell
+  mf_state_t getState(const size_t x, const size_t y, const size_t z);
+
+  // Obvious...
+  size_t width() const { return wdth; }
+  size_t height() const { return hght; }
+  size_t depth() const { return dpth; }
+
+  // Returns true when the user has cleared all empty cells
+  bool hasWon();
+
+  // Marks a cell as being a bomb
+  void mark(const size_t x, const size_t y, const size_t z);
+
+  // Returns the number of bombs near a cell
+  size_t bombsNear(const size_t x, const size_t y, const size_t z);
+
+  // Returns the number of unmarked bombs
+  int64_t minesRemaining();
+
+  // Returns the number of chunks that have been allocated
+  size_t chunksAllocated() const { return chunks.size(); }
+
+  // Returns the bytes used by allocated chunks
+  size_t chunkBytes() const;
+
+ private:
+  // One allocated chunk: cell states and bomb counts, indexed x fastest
+  struct Chunk {
+    mf_cell_t cells[CHUNK_CELLS];
+    unsigned char near_bombs[CHUNK_CELLS];
+  };
+
+  // Bitmap of the bombs in one chunk
+  struct ChunkBombs {
+    uint64_t bits[CHUNK_CELLS/64];
+  };
+
+  // Number of cells of chunk (cx,cy,cz) inside the board
+  size_t chunkCells(size_t cx, size_t cy, size_t cz) const;
+
+  // Number of bombs in chunk (cx,cy,cz)
+  size_t chunkBombCount(size_t cx, size_t cy, size_t cz) const;
+
+  // Places the bombs of chunk (cx,cy,cz)
+  void placeBombs(size_t cx, size_t cy, size_t cz, ChunkBombs &bombs) const;
+
+  // Returns the chunk holding cell (x,y,z), allocating it if needed
+  Chunk &chunkAt(size_t x, size_t y, size_t z);
+
+  // Allocates and initializes chunk (cx,cy,cz)
+  Chunk *createChunk(size_t cx, size_t cy, size_t cz);
+
+  // Used internally to get/set states
+  mf_cell_t &state(const size_t x, const size_t y, const size_t z);
+
+  size_t wdth;
+  size_t hght;
+  size_t dpth;
+  double dnsty;
+  uint64_t seed;
+
+  // Allocated chunks, keyed by packed chunk coordinates
+  std::unordered_map<uint64_t, Chunk*> chunks;
+
+  // The most recently used chunk, so neighboring cells skip the hash lookup
+  uint64_t last_key;
+  Chunk *last_chunk;
+
+  // These are used to keep track of game status to determine winning/losing
+  uint64_t num_bombs;
+  uint64_t num_cleared;
+  uint64_t total_cells;
+  uint64_t fake_marks;
+  uint64_t real_marks;
+
+  // Scratch queue for touch()'s flood fill, reused between calls
+  std::vector<uint64_t> touch_queue;
+};
+
+#endif
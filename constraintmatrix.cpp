@@ -0,0 +1,288 @@
+/*
+  constraintmatrix.cpp
+
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "constraintmatrix.h"
+
+const size_t ConstraintMatrix::PLANES;
+
+ConstraintMatrix::ConstraintMatrix(const size_t columns) : num_columns(columns),
+							   words((columns+63)/64),
+							   overflows(0) {
+}
+
+void ConstraintMatrix::addRow(const uint32_t *columns, const size_t n, const int total) {
+  size_t first = words, last = 0;
+  for (size_t i=0; i<n; ++i) {
+    first = std::min(first, size_t(columns[i]/64));
+    last = std::max(last, size_t(columns[i]/64 + 1));
+  }
+  if (first >= last) {
+    first = last = 0;
+  }
+  first_word.push_back(first);
+  last_word.push_back(last);
+  totals.push_back(total);
+
+  row_bits.push_back(std::vector<uint64_t>((last-first)*PLANES, 0));
+  std::vector<uint64_t> &row = row_bits.back();
+  for (size_t i=0; i<n; ++i) {
+    row[(columns[i]/64 - first)*PLANES] |= uint64_t(1) << (columns[i]%64);
+  }
+}
+
+int ConstraintMatrix::coefficient(const size_t row, const size_t column) const {
+  size_t w = column/64;
+  if (w < first_word[row] || w >= last_word[row]) {
+    return 0;
+  }
+  const uint64_t *planes = word(row, w);
+  int c = 0;
+  for (size_t p=0; p<PLANES; ++p) {
+    c |= int((planes[p] >> (column%64)) & 1) << p;
+  }
+  if (c & (1 << (PLANES-1))) {
+    c -= 1 << PLANES;
+  }
+  return c;
+}
+
+/*!
+  Subtracting b is adding ~b with a carry in of 1, so both are the same
+  adder.  A coefficient overflows where both inputs have the same sign
+  and the sum doesn't.
+*/
+bool ConstraintMatrix::subtractRow(const size_t s, const size_t r, const int multiple) {
+  size_t lo = first_word[r], hi = last_word[r];
+  if (first_word[s] < last_word[s]) {
+    lo = std::min(lo, first_word[s]);
+    hi = std::max(hi, last_word[s]);
+  }
+  bool subtract = (multiple > 0);
+  int times = std::abs(multiple);
+
+  scratch.resize(PLANES*(hi-lo));
+  uint64_t overflow = 0;
+  for (size_t w=lo; w<hi; ++w) {
+    uint64_t a[PLANES], b[PLANES];
+    bool in_s = (w >= first_word[s] && w < last_word[s]);
+    bool in_r = (w >= first_word[r] && w < last_word[r]);
+    for (size_t p=0; p<PLANES; ++p) {
+      a[p] = in_s ? word(s, w)[p] : 0;
+      b[p] = in_r ? word(r, w)[p] : 0;
+      if (subtract) {
+	b[p] = ~b[p];
+      }
+    }
+    for (int t=0; t<times; ++t) {
+      uint64_t carry = subtract ? ~uint64_t(0) : 0;
+      uint64_t sign = a[PLANES-1];
+      for (size_t p=0; p<PLANES; ++p) {
+	uint64_t x = a[p], y = b[p];
+	a[p] = x ^ y ^ carry;
+	carry = (x & y) | (carry & (x ^ y));
+      }
+      overflow |= ~(sign ^ b[PLANES-1]) & (sign ^ a[PLANES-1]);
+    }
+    std::copy(a, a+PLANES, &scratch[(w-lo)*PLANES]);
+  }
+  if (overflow) {
+    return false;
+  }
+
+  // Trim the words that cancelled out
+  auto empty = [&](size_t w) {
+    uint64_t any = 0;
+    for (size_t p=0; p<PLANES; ++p) {
+      any |= scratch[(w-lo)*PLANES + p];
+    }
+    return any == 0;
+  };
+  size_t first = lo, last = hi;
+  while (first < last && empty(first)) ++first;
+  while (last > first && empty(last-1)) --last;
+  row_bits[s].assign(scratch.begin() + (first-lo)*PLANES, scratch.begin() + (last-lo)*PLANES);
+  if (first == last) {
+    first = last = 0;
+  }
+  first_word[s] = first;
+  last_word[s] = last;
+  totals[s] -= multiple*totals[r];
+  return true;
+}
+
+/*!
+  Each column is pivoted on the row with a coefficient of 1 or -1 there
+  that spans the fewest words, to keep the fill in down.  Columns with
+  no such row are skipped.
+
+  The column is cleared from every row that hasn't been a pivot, which
+  is all a row echelon form needs, but only from an earlier pivot row
+  if the new pivot row lies within the words it already spans.  On a
+  banded matrix clearing it from them all would spread each pivot row
+  across the rest of the matrix.
+
+  Words are taken in order, so only the rows that reach the current
+  word are looked at: a row joins when the columns reach its first
+  word, and leaves once they're past its last, since nothing can give
+  it bits there after that.  At the start of each word the rows are
+  sorted into a list per column they have bits in, and a row operation
+  adds the row to the lists of the columns it gains, so a column only
+  looks at the rows that have it.  A list can hold a row more than once,
+  or one that has since lost the column, so each is checked against its
+  bits in the word.
+*/
+void ConstraintMatrix::reduce() {
+  size_t num_rows = totals.size();
+  std::vector<size_t> order(num_rows);
+  for (size_t r=0; r<num_rows; ++r) {
+    order[r] = r;
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return first_word[a] < first_word[b]; });
+
+  std::vector<size_t> active;
+  std::vector<unsigned char> pivot(num_rows, 0);
+  std::vector<uint64_t> live(num_rows, 0);
+  std::vector<std::vector<size_t> > has_column(64);
+  auto bits = [&](size_t r, size_t w) {
+    uint64_t any = 0;
+    if (w >= first_word[r] && w < last_word[r]) {
+      for (size_t p=0; p<PLANES; ++p) {
+	any |= word(r, w)[p];
+      }
+    }
+    return any;
+  };
+  auto span = [&](size_t r) { return last_word[r] - first_word[r]; };
+
+  size_t next = 0;
+  overflows = 0;
+  for (size_t w=0; w<words; ++w) {
+    auto finished = [&](size_t r) { return last_word[r] <= w; };
+    active.erase(std::remove_if(active.begin(), active.end(), finished), active.end());
+    for (; next < num_rows && first_word[order[next]] <= w; ++next) {
+      if (last_word[order[next]] > w) {
+	active.push_back(order[next]);
+      }
+    }
+    for (size_t b=0; b<64; ++b) {
+      has_column[b].clear();
+    }
+    for (size_t i=0; i<active.size(); ++i) {
+      size_t r = active[i];
+      live[r] = bits(r, w);
+      for (uint64_t any = live[r]; any; any &= any - 1) {
+	has_column[__builtin_ctzll(any)].push_back(r);
+      }
+    }
+
+    for (size_t b=0; b<64 && w*64 + b < num_columns; ++b) {
+      size_t j = w*64 + b;
+      uint64_t bit = uint64_t(1) << b;
+      const std::vector<size_t> &rows = has_column[b];
+
+      size_t r = num_rows;
+      for (size_t i=0; i<rows.size(); ++i) {
+	size_t s = rows[i];
+	if (pivot[s] || !(live[s] & bit)) continue;
+	int c = coefficient(s, j);
+	if ((c == 1 || c == -1) && (r == num_rows || span(s) < span(r))) {
+	  r = s;
+	}
+      }
+      if (r == num_rows) continue;
+
+      pivot[r] = 1;
+      int p = coefficient(r, j);
+      for (size_t i=0; i<rows.size(); ++i) {
+	size_t s = rows[i];
+	if (s == r || !(live[s] & bit)) continue;
+	if (pivot[s] && (first_word[r] < first_word[s] || last_word[s] < last_word[r])) continue;
+
+	// A row that would overflow keeps its coefficient in the column.
+	// It's still the sum of multiples of the rows it started as, so
+	// anything forced() finds in it holds; the matrix is only less
+	// reduced.
+	if (!subtractRow(s, r, coefficient(s, j)*p)) {
+	  ++overflows;
+	  continue;
+	}
+	uint64_t now = bits(s, w);
+	for (uint64_t gained = now & ~live[s] & ~((bit << 1) - 1); gained; gained &= gained - 1) {
+	  has_column[__builtin_ctzll(gained)].push_back(s);
+	}
+	live[s] = now;
+      }
+    }
+  }
+}
+
+/*!
+  With the cell left out, the rest of a row can make anything from the
+  sum of its negative coefficients to the sum of its positive ones.  A
+  value for the cell is ruled out if the rest can't make up the
+  difference to the total.  Only a row whose total is within the
+  biggest coefficient of either end can rule anything out.
+*/
+size_t ConstraintMatrix::forced(std::vector<uint32_t> &columns,
+				std::vector<unsigned char> &values) const {
+  size_t found = 0;
+  std::vector<uint32_t> cols;
+  std::vector<int> coefs;
+  for (size_t r=0; r<totals.size(); ++r) {
+    cols.clear();
+    coefs.clear();
+    int low = 0, high = 0, biggest = 0;
+    for (size_t w=first_word[r]; w<last_word[r]; ++w) {
+      uint64_t any = 0;
+      for (size_t p=0; p<PLANES; ++p) {
+	any |= word(r, w)[p];
+      }
+      while (any) {
+	size_t column = w*64 + size_t(__builtin_ctzll(any));
+	any &= any - 1;
+	int c = coefficient(r, column);
+	cols.push_back(uint32_t(column));
+	coefs.push_back(c);
+	low += std::min(c, 0);
+	high += std::max(c, 0);
+	biggest = std::max(biggest, std::abs(c));
+      }
+    }
+    int total = totals[r];
+    if (cols.empty() || (total - low >= biggest && high - total >= biggest)) continue;
+
+    for (size_t i=0; i<cols.size(); ++i) {
+      int c = coefs[i];
+      int rest_low = low - std::min(c, 0), rest_high = high - std::max(c, 0);
+      bool zero = (total >= rest_low && total <= rest_high);
+      bool one = (total - c >= rest_low && total - c <= rest_high);
+      if (zero != one) {
+	columns.push_back(cols[i]);
+	values.push_back(one);
+	++found;
+      }
+    }
+  }
+  return found;
+}
@@ -0,0 +1,98 @@
+/*
+  constraintmatrix.h
+
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CONSTRAINTMATRIX_H
+#define CONSTRAINTMATRIX_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+/*!
+  ConstraintMatrix holds a set of linear equations over 0/1 cells, sum
+  of coefficient * cell = total, and row reduces them to find cells
+  whose value is forced.
+
+  Coefficients are small signed integers stored bit sliced: each row
+  is PLANES bitsets over the columns, one per bit of the coefficient in
+  two's complement, so adding or subtracting two rows is a ripple carry
+  adder run on 64 columns at a time.  The lowest plane on its own is the
+  row over GF(2), and a row operation on it is an XOR.  An operation
+  that would overflow a coefficient isn't done, which leaves a valid,
+  if less reduced, matrix.
+
+  Each row only stores the range of words it has bits in, and row
+  operations only run over those, so a matrix whose columns are
+  numbered so each row's are close together stays cheap however wide
+  it is.
+*/
+class ConstraintMatrix {
+ public:
+  explicit ConstraintMatrix(const size_t columns);
+
+  // Adds the equation that the cells in columns[0...n] sum to total
+  void addRow(const uint32_t *columns, const size_t n, const int total);
+
+  // Row reduces the matrix, pivoting on coefficients of 1 or -1
+  void reduce();
+
+  // Finds the cells a row forces: those for which one value would
+  // leave the rest of the row unable to reach its total whatever they
+  // are.  Appends their columns and values.  Returns how many it found;
+  // a column may be found more than once.
+  size_t forced(std::vector<uint32_t> &columns, std::vector<unsigned char> &values) const;
+
+  size_t rows() const { return totals.size(); }
+
+  // How many row operations the last reduce() left undone because a
+  // coefficient would have overflowed
+  size_t overflowed() const { return overflows; }
+
+ private:
+  // Bits per coefficient, so coefficients are in [-8, 8)
+  static const size_t PLANES = 4;
+
+  int coefficient(const size_t row, const size_t column) const;
+
+  // Subtracts multiple times row r from row s.  Returns false, leaving s
+  // alone, if a coefficient would overflow.
+  bool subtractRow(const size_t s, const size_t r, const int multiple);
+
+  // The planes of word w of a row, which must be in its span
+  const uint64_t *word(const size_t row, const size_t w) const {
+    return &row_bits[row][(w - first_word[row])*PLANES];
+  }
+
+  size_t num_columns;
+  size_t words;
+  size_t overflows;
+
+  // Each row holds only the words [first_word, last_word) it has bits
+  // in, each as PLANES consecutive planes
+  std::vector<std::vector<uint64_t> > row_bits;
+  std::vector<size_t> first_word;
+  std::vector<size_t> last_word;
+  std::vector<int> totals;
+
+  std::vector<uint64_t> scratch;
+};
+
+#endif
@@ -0,0 +1,217 @@
+/*
+  fixedminefield.h
+
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FIXEDMINEFIELD_H
+#define FIXEDMINEFIELD_H
+
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+
+#include "minefield.h"
+#include "minefieldcells.h"
+
+/*!
+  FixedMinefield is a Minefield whose size is fixed at compile time, for
+  headless tools that play lots of games at the built in difficulty
+  levels.  The cells, the counts and the flood fill queue are stored
+  inside the object, so making one doesn't touch the heap, and all of
+  the loops are compiled for the exact size through FixedPaddedLayout.
+
+  For the same size, mine count and seed, the board is the same as
+  Minefield's.  Only the basic game is here: there's no changes() list,
+  journal or batched operations.
+*/
+template <size_t W, size_t H, size_t D>
+class FixedMinefield {
+ public:
+  FixedMinefield(const int n=50, const uint64_t seed=0);
+
+  // touch is called when a cell is clicked on.
+  size_t touch(const size_t x, const size_t y, const size_t z);
+
+  // Returns the state of a cell
+  mf_state_t getState(const size_t x, const size_t y, const size_t z) const;
+
+  // Obvious...
+  static constexpr size_t width() { return W; }
+  static constexpr size_t height() { return H; }
+  static constexpr size_t depth() { return D; }
+
+  // The seed the mines were placed with
+  uint64_t seed() const { return rng_seed; }
+
+  // Returns true when all empty cells have been cleared
+  bool hasWon() const { return num_cleared == CELLS-num_bombs; }
+
+  // Marks a cell as being a bomb
+  void mark(const size_t x, const size_t y, const size_t z);
+
+  // Returns the number of bombs near a cell
+  size_t bombsNear(const size_t x, const size_t y, const size_t z) const;
+
+  // Returns the number of unmarked bombs
+  int minesRemaining() const { return num_bombs-(fake_marks+real_marks); }
+
+ private:
+  typedef FixedPaddedLayout<W,H,D> Layout;
+  static const size_t CELLS = W*H*D;
+
+  // Value of the cells in the border around the field
+  static const mf_cell_t BORDER_CELL = 0xff;
+
+  static void checkIndex(const size_t x, const size_t y, const size_t z) {
+    if (x >= W || y >= H || z >= D) {
+      throw std::runtime_error("Invalid index");
+    }
+  }
+
+  // Laid out like Minefield's, with a one cell border
+  mf_cell_t field[Layout::SLOTS];
+  unsigned char near_bombs[Layout::SLOTS];
+
+  // floodOpen()'s queue.  Each cell is queued at most once per touch().
+  struct TouchQueue {
+    size_t slots[CELLS];
+    size_t tail;
+
+    size_t size() const { return tail; }
+    size_t operator[](const size_t i) const { return slots[i]; }
+    void push_back(const size_t s) { slots[tail++] = s; }
+  } touch_queue;
+
+  int num_bombs;
+  size_t num_cleared;
+  int fake_marks;
+  int real_marks;
+  uint64_t rng_seed;
+};
+
+template <size_t W, size_t H, size_t D>
+const mf_cell_t FixedMinefield<W,H,D>::BORDER_CELL;
+
+/*!
+  The constructor places the mines with placeMinesFloyd(), as Minefield
+  does, and counts the bombs near each cell.
+*/
+template <size_t W, size_t H, size_t D>
+FixedMinefield<W,H,D>::FixedMinefield(const int n, const uint64_t sd):
+  num_bombs(n), num_cleared(0), fake_marks(0), real_marks(0), rng_seed(sd) {
+  if (n < 0 || size_t(n) > CELLS) {
+    throw std::runtime_error("Invalid number of bombs");
+  }
+
+  placeMinesFloyd(Layout(), field, Layout::SLOTS, BORDER_CELL, W, H, D, size_t(n), rng_seed);
+
+  // A bomb counts towards its own cell, as in Minefield
+  std::fill(near_bombs, near_bombs+Layout::SLOTS, 0);
+  for (size_t k=0; k<D; ++k) {
+    for (size_t j=0; j<H; ++j) {
+      size_t s = Layout::slot(0,j,k);
+      for (size_t i=0; i<W; ++i, ++s) {
+	unsigned char count = (field[s] == closed_bomb);
+	Layout::forEachNeighbor(s, [&](size_t nb) {
+	    count += (field[nb] == closed_bomb);
+	  });
+	near_bombs[s] = count;
+      }
+    }
+  }
+}
+
+/*!
+  Opens a cell and, like Minefield::touch(), the empty region around it.
+  Returns the number of cells opened.
+*/
+template <size_t W, size_t H, size_t D>
+size_t FixedMinefield<W,H,D>::touch(const size_t x, const size_t y, const size_t z) {
+  checkIndex(x,y,z);
+
+  size_t start = Layout::slot(x,y,z);
+  if (field[start] != closed) return 0;
+
+  field[start] = open;
+  touch_queue.tail = 0;
+  touch_queue.push_back(start);
+  floodOpen(Layout(), field, near_bombs, touch_queue, 0, CELLS);
+  num_cleared += touch_queue.size();
+  return touch_queue.size();
+}
+
+template <size_t W, size_t H, size_t D>
+mf_state_t FixedMinefield<W,H,D>::getState(const size_t x, const size_t y, const size_t z) const {
+  checkIndex(x,y,z);
+  return mf_state_t(field[Layout::slot(x,y,z)]);
+}
+
+template <size_t W, size_t H, size_t D>
+size_t FixedMinefield<W,H,D>::bombsNear(const size_t x, const size_t y, const size_t z) const {
+  checkIndex(x,y,z);
+  return near_bombs[Layout::slot(x,y,z)];
+}
+
+/*!
+  mark() marks a cell as a bomb, or removes an existing mark.
+*/
+template <size_t W, size_t H, size_t D>
+void FixedMinefield<W,H,D>::mark(const size_t x, const size_t y, const size_t z) {
+  checkIndex(x,y,z);
+
+  mf_cell_t &cell = field[Layout::slot(x,y,z)];
+  mf_mark_change_t change = markChange(cell);
+  cell = change.after;
+  fake_marks += change.fake;
+  real_marks += change.real;
+}
+
+/*!
+  withBoard() makes an n^3 board and calls f with it: a FixedMinefield
+  for the sizes of the built in difficulty levels, and a Minefield
+  otherwise.  It's for headless tools that only play the basic game, so
+  f has to work with either, e.g. a generic lambda.
+*/
+template <class F>
+void withBoard(const size_t n, const int mines, const uint64_t seed, F f) {
+  switch (n) {
+  case 6: {
+    FixedMinefield<6,6,6> mf(mines, seed);
+    f(mf);
+    return;
+  }
+  case 11: {
+    FixedMinefield<11,11,11> mf(mines, seed);
+    f(mf);
+    return;
+  }
+  case 15: {
+    FixedMinefield<15,15,15> mf(mines, seed);
+    f(mf);
+    return;
+  }
+  default: {
+    Minefield mf(n, n, n, mines, seed);
+    f(mf);
+    return;
+  }
+  }
+}
+
+#endif
@@ -43,6 +43,10 @@ MainWindow::MainWindow() : QMainWindow(), lost(false) {
   lost = true;
   // Default to easy difficulty
   difficulty=0;
+
+  // and the original neighborhood
+  stencil = corner_stencil;
+  topology = bounded_topology;
   
   
   
@@ -102,6 +106,12 @@ MainWindow::~MainWindow() {
   delete easyAction;
   delete medAction;
   delete hardAction;
+
+  delete cornerAction;
+  delete edgeAction;
+  delete faceAction;
+  delete wrapAction;
+  delete autoOpenAction;
   
   delete theToolbar;
   
@@ -172,6 +182,35 @@ void MainWindow::createActions() {
   hardAction->setStatusTip(tr("Start a hard game"));
   connect(hardAction, SIGNAL(triggered()), this, SLOT(startHardGame()));
 
+  // Neighborhoods
+  cornerAction = new QAction(tr("26 Neighbors"), this);
+  cornerAction->setCheckable(true);
+  cornerAction->setStatusTip(tr("Cells sharing a corner are neighbors"));
+  cornerAction->setChecked(true);
+  connect(cornerAction, SIGNAL(triggered()), this, SLOT(useCornerNeighbors()));
+
+  edgeAction = new QAction(tr("18 Neighbors"), this);
+  edgeAction->setCheckable(true);
+  edgeAction->setStatusTip(tr("Cells sharing an edge are neighbors"));
+  connect(edgeAction, SIGNAL(triggered()), this, SLOT(useEdgeNeighbors()));
+
+  faceAction = new QAction(tr("6 Neighbors"), this);
+  faceAction->setCheckable(true);
+  faceAction->setStatusTip(tr("Cells sharing a face are neighbors"));
+  connect(faceAction, SIGNAL(triggered()), this, SLOT(useFaceNeighbors()));
+
+  // Wrap around
+  wrapAction = new QAction(tr("Wrap Around"), this);
+  wrapAction->setCheckable(true);
+  wrapAction->setStatusTip(tr("Cells on opposite faces are neighbors"));
+  connect(wrapAction, SIGNAL(triggered()), this, SLOT(toggleWrap()));
+
+  // Auto open
+  autoOpenAction = new QAction(tr("Open Obvious Cells"), this);
+  autoOpenAction->setCheckable(true);
+  autoOpenAction->setStatusTip(tr("Open the cells that are certainly safe after each click"));
+  connect(autoOpenAction, SIGNAL(triggered()), this, SLOT(toggleAutoOpen()));
+
   // Show High Scores dialog box
   highScoresAction = new QAction(tr("High Scores"), this);
   highScoresAction->setStatusTip(tr("Show high scores"));
@@ -198,6 +237,14 @@ void MainWindow::createMenus() {
   optionsMenu->addAction(easyAction);
   optionsMenu->addAction(medAction);
   optionsMenu->addAction(hardAction);
+  optionsMenu->addSeparator();
+  optionsMenu->addAction(cornerAction);
+  optionsMenu->addAction(edgeAction);
+  optionsMenu->addAction(faceAction);
+  optionsMenu->addSeparator();
+  optionsMenu->addAction(wrapAction);
+  optionsMenu->addSeparator();
+  optionsMenu->addAction(autoOpenAction);
 
   // Help menu
   helpMenu = menuBar()->addMenu(tr("&Help"));
@@ -301,7 +348,10 @@ void MainWindow::winGame() {
 
     double elapsed = difftime(end_time, start_time);
 
-    if (elapsed < best_times[difficulty]) {
+    // High scores are only kept for the original neighborhood, played
+    // without help
+    if (elapsed < best_times[difficulty]
+	&& stencil == corner_stencil && topology == bounded_topology && !qmf->wasHelped()) {
       QString difs[] = {tr("easy"), tr("medm"), tr("hard")};
       
       qset->setValue(difs[difficulty] + tr("_name"), getenv("USERNAME"));
@@ -403,6 +453,56 @@ void MainWindow::startHardGame() {
   }
 }
 
+/*!
+  Starts a new game with a different neighborhood, if the user agrees
+*/
+void MainWindow::changeNeighborhood(mf_stencil_t st, mf_topology_t tp) {
+  if (!start_time || lost || QMessageBox::warning(this, tr("Minesweeper 3D"),
+				   tr("Really start a new game?"),
+				   QMessageBox::Yes | QMessageBox::Default,
+				   QMessageBox::No, QMessageBox::Cancel | QMessageBox::Escape)==QMessageBox::Yes) {
+    stencil = st;
+    topology = tp;
+    lost = false;
+    qmf->setNeighborhood(stencil, topology);
+    qmf->startNewGame( difficultySizes[difficulty], difficultySizes[difficulty], difficultySizes[difficulty], difficultyBombs[difficulty]);
+    start_time = 0;
+    updateStatusBar(difficultyBombs[difficulty]);
+  }
+
+  // Show what's in use, even if the user changed their mind
+  cornerAction->setChecked(stencil == corner_stencil);
+  edgeAction->setChecked(stencil == edge_stencil);
+  faceAction->setChecked(stencil == face_stencil);
+  wrapAction->setChecked(topology == torus_topology);
+}
+
+/*!
+  Switch between the neighborhoods
+*/
+void MainWindow::useCornerNeighbors() {
+  changeNeighborhood(corner_stencil, topology);
+}
+
+void MainWindow::useEdgeNeighbors() {
+  changeNeighborhood(edge_stencil, topology);
+}
+
+void MainWindow::useFaceNeighbors() {
+  changeNeighborhood(face_stencil, topology);
+}
+
+void MainWindow::toggleWrap() {
+  changeNeighborhood(stencil, topology == torus_topology ? bounded_topology : torus_topology);
+}
+
+/*!
+  Turns auto open on or off, from the next click
+*/
+void MainWindow::toggleAutoOpen() {
+  qmf->setAutoOpen(autoOpenAction->isChecked());
+}
+
 void MainWindow::readHighScores() {
   qset->sync();
   best_times[DIF_EASY] = qset->value("easy_time", 1000).toInt();
@@ -26,6 +26,8 @@
 #include <QDateTime>
 #include <ctime>
 
+#include "neighborhood.h"
+
 class QAction;
 class QMinefield;
 class QLabel;
@@ -61,6 +63,11 @@ class MainWindow : public QMainWindow {
   void startEasyGame();
   void startMediumGame();
   void startHardGame();
+  void useCornerNeighbors();
+  void useEdgeNeighbors();
+  void useFaceNeighbors();
+  void toggleWrap();
+  void toggleAutoOpen();
   void showHighScores();
   void updateStatusBar(int num_bombs);
 
@@ -75,6 +82,7 @@ class MainWindow : public QMainWindow {
   void createMenus();
   void createToolbar();
   void createStatusBar();
+  void changeNeighborhood(mf_stencil_t st, mf_topology_t tp);
   void closeEvent(QCloseEvent *event);
 
  private:
@@ -88,6 +96,12 @@ class MainWindow : public QMainWindow {
   QAction *medAction;
   QAction *hardAction;
 
+  QAction *cornerAction;
+  QAction *edgeAction;
+  QAction *faceAction;
+  QAction *wrapAction;
+  QAction *autoOpenAction;
+
   QAction *highScoresAction;
 
 
@@ -109,6 +123,10 @@ class MainWindow : public QMainWindow {
 
   // Current difficulty level
   int difficulty;
+
+  // Which cells are neighbors, and whether the board wraps around
+  mf_stencil_t stencil;
+  mf_topology_t topology;
   
   // Parameters for each difficulty level
   int difficultySizes[NUM_DIFFICULTIES];
@@ -6,9 +6,10 @@ TEMPLATE = app
 TARGET = 
 DEPENDPATH += .
 INCLUDEPATH += .
+CONFIG += c++14
 QT += opengl
 
 # Input
-HEADERS += mainwindow.h minefield.h qminefield.h
-SOURCES += main.cpp mainwindow.cpp minefield.cpp qminefield.cpp
+HEADERS += bombcount.h celllayout.h chunkedminefield.h constraintmatrix.h fixedminefield.h mainwindow.h minefield.h minefieldcells.h minefieldestimator.h minefieldpool.h minefieldprobability.h minefieldsolver.h neighborhood.h parallel.h qminefield.h rng.h
+SOURCES += bombcount.cpp chunkedminefield.cpp constraintmatrix.cpp main.cpp mainwindow.cpp minefield.cpp minefieldestimator.cpp minefieldpool.cpp minefieldprobability.cpp minefieldsolver.cpp parallel.cpp qminefield.cpp
 RESOURCES += mine3d.qrc
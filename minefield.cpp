@@ -19,89 +19,674 @@
   along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <cstdlib>
+#include <algorithm>
+#include <new>
 #include <stdexcept>
+#include <utility>
 
 #include "minefield.h"
+#include "minefieldcells.h"
+#include "minefieldpool.h"
+#include "bombcount.h"
+#include "parallel.h"
+#include "rng.h"
+
+// Boards with at least this many cells are generated in parallel
+static const size_t PARALLEL_CELLS = size_t(1) << 18;
+
+// Roughly how many cells each parallel generation task covers
+static const size_t SLAB_CELLS = size_t(1) << 16;
+
+// On boards of at least PARALLEL_CELLS, a flood fill that's still going
+// after this many cells continues on all cores
+static const size_t PARALLEL_CASCADE_CELLS = size_t(1) << 14;
+
+// Number of frontier cells in each parallel flood fill task
+static const size_t CASCADE_BLOCK = 1024;
+
+// Value of the cells in the border around the field
+static const mf_cell_t BORDER_CELL = 0xff;
+
+// Boards with this many cells, up to REGION_CELLS, have their openings
+// labelled when they're generated
+static const size_t REGION_MIN_CELLS = size_t(1) << 15;
+static const size_t REGION_CELLS = size_t(1) << 24;
+
+// region_label of cells that aren't in an opening
+static const uint32_t NO_REGION = 0xffffffff;
+
+// Bytes at the start of field's and near_bombs' buffers for their
+// reference counts, keeping the arrays aligned
+static const size_t BUFFER_HEADER = 16;
+
+/*!
+  Returns the reference count at the start of the buffer holding cells
+*/
+static inline size_t *bufferRefs(mf_cell_t *cells) {
+  return reinterpret_cast<size_t *>(cells - BUFFER_HEADER);
+}
+
+/*!
+  Returns true if another board holds the buffer too
+*/
+static inline bool bufferShared(mf_cell_t *cells) {
+  return cells && __atomic_load_n(bufferRefs(cells), __ATOMIC_ACQUIRE) > 1;
+}
+
+/*!
+  Calls f with the layout the board uses and returns what it returns.
+  f is usually a generic lambda, so its body is compiled once for each
+  layout and the layout's slot() and neighbor() inline into it.
+  Row major boards the size of the built in difficulty levels get a
+  FixedPaddedLayout, so their loops are compiled for that exact size.
+  Boards with the original neighborhood get the layout itself; others
+  get it wrapped by withNeighborhood().
+*/
+template <class F>
+inline decltype(auto) Minefield::withLayout(F f) const {
+  if (cell_stencil != corner_stencil || cell_topology != bounded_topology) {
+    if (cell_layout == bricked_layout) {
+      return withNeighborhood(bricked, f);
+    }
+    return withNeighborhood(padded, f);
+  }
+
+  if (cell_layout == bricked_layout) {
+    return f(bricked);
+  }
+  switch (fixed_size) {
+  case 6:
+    return f(FixedPaddedLayout<6,6,6>());
+  case 11:
+    return f(FixedPaddedLayout<11,11,11>());
+  case 15:
+    return f(FixedPaddedLayout<15,15,15>());
+  }
+  return f(padded);
+}
+
+/*!
+  Calls f with layout l wrapped in the board's topology and stencil (see
+  neighborhood.h), so each combination's loops are compiled separately.
+*/
+template <class L, class F>
+inline decltype(auto) Minefield::withNeighborhood(const L &l, F f) const {
+  if (cell_topology == torus_topology) {
+    const unsigned char *edges = torus_edges.data();
+    switch (cell_stencil) {
+    case edge_stencil:
+      return f(TorusTopology<L, EdgeStencil>(l, edges, wdth, hght, dpth));
+    case face_stencil:
+      return f(TorusTopology<L, FaceStencil>(l, edges, wdth, hght, dpth));
+    default:
+      return f(TorusTopology<L, CornerStencil>(l, edges, wdth, hght, dpth));
+    }
+  }
+  switch (cell_stencil) {
+  case edge_stencil:
+    return f(BoundedTopology<L, EdgeStencil>(l));
+  case face_stencil:
+    return f(BoundedTopology<L, FaceStencil>(l));
+  default:
+    return f(BoundedTopology<L, CornerStencil>(l));
+  }
+}
 
 /*!
   The constructor allocates the minefield and populates it with mines
   It also initializes all private variables.
+  The mines are placed by a generator seeded with seed, so the same
+  size, mine count and seed always give the same board, in any layout.
+  If a pool is given, the arrays and scratch space come from it, and go
+  back to it when the board is deleted.
 */
 Minefield::Minefield(const size_t w, const size_t h, const size_t d,
-		     const int n): wdth(w), hght(h), dpth(d),
-				      num_bombs(n), num_cleared(0),
-				      total_cells(w*h*d), num_marked(0), fake_marks(0), real_marks(0) {
-  field = new mf_state_t[w*h*d];
+		     const int n, const uint64_t sd,
+		     const mf_layout_t lay, MinefieldPool *pool): field(0), near_bombs(0),
+								  field_capacity(0), count_capacity(0),
+								  buffer_pool(pool),
+								  cell_stencil(corner_stencil),
+								  cell_topology(bounded_topology),
+								  label_regions(true), concurrent(false),
+								  record_changes(true), old_runs(0), runs_stale(true),
+								  journal_limit(0),
+								  journal_pos(0), journal_op_started(false) {
+  if (buffer_pool) {
+    buffer_pool->takeVector(touch_queue);
+    buffer_pool->takeVector(change_list);
+    buffer_pool->takeVector(region_label);
+    buffer_pool->takeVector(region_start);
+    buffer_pool->takeVector(region_cells);
+    buffer_pool->takeVector(region_tainted);
+    buffer_pool->takeVector(torus_edges);
+  }
+  reset(w, h, d, n, sd, lay);
+}
+
+/*!
+  The fork constructor, used by fork().  The fork shares the parent's
+  field and near_bombs buffers, so making one costs no more than copying
+  the object itself, whatever the size of the board.  The first change
+  to either board copies its field, all of it, for that board (see
+  ownBuffers()); near_bombs stays shared unless the mines or the
+  neighborhood change.
+  Everything else that the board changes is copied, except the openings
+  (setRegionLabels()), which are left out, so the fork opens cells with
+  the flood fill until reset() labels a new board.  changes() and the
+  journal start empty, with the journal's limit kept.
+  The fork uses the parent's pool, if it has one, which may then be
+  used from whichever threads the two boards go to.  Boards in
+  concurrent mode never share field, so the fork gets a copy straight
+  away.
+*/
+Minefield::Minefield(const Minefield &parent): field(parent.field), near_bombs(parent.near_bombs),
+					       field_capacity(parent.field_capacity),
+					       count_capacity(parent.count_capacity),
+					       buffer_pool(parent.buffer_pool),
+					       wdth(parent.wdth), hght(parent.hght), dpth(parent.dpth),
+					       num_bombs(parent.num_bombs), cell_layout(parent.cell_layout),
+					       padded(parent.padded), bricked(parent.bricked),
+					       cell_stencil(parent.cell_stencil),
+					       cell_topology(parent.cell_topology),
+					       fixed_size(parent.fixed_size), total_slots(parent.total_slots),
+					       num_cleared(parent.num_cleared), total_cells(parent.total_cells),
+					       num_marked(parent.num_marked), fake_marks(parent.fake_marks),
+					       real_marks(parent.real_marks), rng_seed(parent.rng_seed),
+					       label_regions(parent.label_regions),
+					       concurrent(parent.concurrent),
+					       record_changes(parent.record_changes),
+					       old_runs(0), runs_stale(true),
+					       journal_limit(parent.journal_limit),
+					       journal_pos(0), journal_op_started(false) {
+  if (buffer_pool) {
+    buffer_pool->takeVector(touch_queue);
+    buffer_pool->takeVector(change_list);
+    buffer_pool->takeVector(region_label);
+    buffer_pool->takeVector(region_start);
+    buffer_pool->takeVector(region_cells);
+    buffer_pool->takeVector(region_tainted);
+    buffer_pool->takeVector(torus_edges);
+  }
+  torus_edges.assign(parent.torus_edges.begin(), parent.torus_edges.end());
+
+  if (field) {
+    __atomic_add_fetch(bufferRefs(field), 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(bufferRefs(near_bombs), 1, __ATOMIC_RELAXED);
+    if (concurrent) {
+      ownBuffers();
+    }
+  }
+}
+
+/*!
+  fork() returns a copy of the board, for search and what-if tools that
+  try moves out on many copies of a board.  The copy is cheap: the cells
+  and counts are shared until one of the boards changes (see the fork
+  constructor).  It must not be called while other threads are changing
+  the board.
+*/
+Minefield Minefield::fork() const {
+  return Minefield(*this);
+}
+
+/*!
+  The move constructor and assignment take other's arrays and scratch
+  space instead of copying them.  other is left an empty 0x0x0 board,
+  which can be reset() or deleted.
+*/
+Minefield::Minefield(Minefield &&other): field(0), near_bombs(0), field_capacity(0),
+					 count_capacity(0), buffer_pool(0) {
+  moveFrom(other);
+}
+
+Minefield &Minefield::operator=(Minefield &&other) {
+  if (this != &other) {
+    releaseStorage();
+    moveFrom(other);
+  }
+  return *this;
+}
+
+/*!
+  Moves every member of other into this board, whose own arrays must
+  already have been released
+*/
+void Minefield::moveFrom(Minefield &other) {
+  field = other.field;
+  near_bombs = other.near_bombs;
+  field_capacity = other.field_capacity;
+  count_capacity = other.count_capacity;
+  buffer_pool = other.buffer_pool;
+  wdth = other.wdth;
+  hght = other.hght;
+  dpth = other.dpth;
+  num_bombs = other.num_bombs;
+  cell_layout = other.cell_layout;
+  padded = other.padded;
+  bricked = std::move(other.bricked);
+  cell_stencil = other.cell_stencil;
+  cell_topology = other.cell_topology;
+  torus_edges.swap(other.torus_edges);
+  fixed_size = other.fixed_size;
+  total_slots = other.total_slots;
+  num_cleared = other.num_cleared;
+  total_cells = other.total_cells;
+  num_marked = other.num_marked;
+  fake_marks = other.fake_marks;
+  real_marks = other.real_marks;
+  rng_seed = other.rng_seed;
+  region_label.swap(other.region_label);
+  region_start.swap(other.region_start);
+  region_cells.swap(other.region_cells);
+  region_tainted.swap(other.region_tainted);
+  label_regions = other.label_regions;
+  concurrent = other.concurrent;
+  touch_queue.swap(other.touch_queue);
+  cascade_next.swap(other.cascade_next);
+  change_list.swap(other.change_list);
+  record_changes = other.record_changes;
+  run_list.swap(other.run_list);
+  row_first.swap(other.row_first);
+  row_last.swap(other.row_last);
+  row_views.swap(other.row_views);
+  row_changed.swap(other.row_changed);
+  old_runs = other.old_runs;
+  runs_stale = other.runs_stale;
+  journal_limit = other.journal_limit;
+  journal.swap(other.journal);
+  journal_ops.swap(other.journal_ops);
+  journal_pos = other.journal_pos;
+  journal_op_started = other.journal_op_started;
+
+  // An empty board, with nothing of its own to give back
+  other.field = 0;
+  other.near_bombs = 0;
+  other.field_capacity = other.count_capacity = 0;
+  other.buffer_pool = 0;
+  other.wdth = other.hght = other.dpth = 0;
+  other.num_bombs = 0;
+  other.padded.resize(0,0,0);
+  other.bricked.resize(0,0,0);
+  other.fixed_size = 0;
+  other.total_slots = 0;
+  other.num_cleared = other.total_cells = other.num_marked = 0;
+  other.fake_marks = other.real_marks = 0;
+  other.torus_edges.clear();
+  other.clearRegions();
+  other.touch_queue.clear();
+  other.change_list.clear();
+  other.runs_stale = true;
+  other.journal.clear();
+  other.journal_ops.clear();
+  other.journal_pos = 0;
+  other.journal_op_started = false;
+}
+
+/*!
+  reset() starts a new game on the board, as if it had been deleted and
+  made again with these arguments, but it keeps its arrays if they're
+  big enough, and its scratch space, so playing game after game on the
+  same board doesn't touch the heap.  The journal is cleared, but stays
+  on if it was on, and the neighborhood stays as it was.
+*/
+void Minefield::reset(const size_t w, const size_t h, const size_t d,
+		      const int n, const uint64_t sd, const mf_layout_t lay) {
+  if (n < 0 || size_t(n) > w*h*d) {
+    throw std::runtime_error("Invalid number of bombs");
+  }
+
+  wdth = w;
+  hght = h;
+  dpth = d;
+  num_bombs = n;
+  cell_layout = lay;
+  num_cleared = 0;
+  total_cells = w*h*d;
+  num_marked = 0;
+  fake_marks = 0;
+  real_marks = 0;
+  rng_seed = sd;
+  change_list.clear();
+  runs_stale = true;
+  setJournal(journal_limit);
 
-  // Clear the field
-  for (size_t i=0;i<w;++i) {
-    for (size_t j=0;j<h;++j) {
-      for (size_t k=0;k<d;++k) {
-	state(i,j,k) = closed;
+  // The row major layout is always set up, because countNeighbors()
+  // works in it
+  padded.resize(w,h,d);
+  fixed_size = 0;
+  if (cell_layout == row_major_layout && w == h && w == d && (w == 6 || w == 11 || w == 15)) {
+    fixed_size = w;
+  }
+  bricked.resize(cell_layout == bricked_layout ? w : 0,
+		 cell_layout == bricked_layout ? h : 0,
+		 cell_layout == bricked_layout ? d : 0);
+  total_slots = withLayout([](const auto &l) { return l.slots(); });
+  findTorusEdges();
+
+  // A fork may share field and near_bombs, so they're only reused if
+  // it doesn't
+  if (total_slots > std::min(field_capacity, count_capacity) || sharesBuffers()) {
+    releaseBuffers();
+    allocateBuffers(total_slots);
+  }
+
+  // Small boards get all the scratch space a game can need up front
+  if (total_cells < PARALLEL_CELLS) {
+    touch_queue.reserve(total_cells);
+    change_list.reserve(total_cells);
+  }
+
+  withLayout([&](const auto &l) {
+      if (total_cells >= PARALLEL_CELLS) {
+	placeMinesParallel(l);
+      } else {
+	placeMines(l);
+      }
+    });
+
+  countNeighbors();
+  clearRegions();
+  if (label_regions && total_cells >= REGION_MIN_CELLS && total_cells <= REGION_CELLS) {
+    withLayout([&](const auto &l) { labelRegions(l); });
+  }
+}
+
+/*!
+  On a torus, flags the slots of the cells on the faces of the board,
+  the only ones whose neighbors wrap around.  Bounded boards don't use
+  the table.
+*/
+void Minefield::findTorusEdges() {
+  torus_edges.clear();
+  if (cell_topology != torus_topology) return;
+
+  bool wrap_x = wdth >= 3, wrap_y = hght >= 3, wrap_z = dpth >= 3;
+  torus_edges.assign(total_slots, 0);
+  withLayout([&](const auto &l) {
+      for (size_t k=0; k<dpth; ++k) {
+	for (size_t j=0; j<hght; ++j) {
+	  bool whole_row = (wrap_z && (k == 0 || k == dpth-1)) || (wrap_y && (j == 0 || j == hght-1));
+	  for (size_t i=0; i<wdth; ++i) {
+	    if (whole_row || (wrap_x && (i == 0 || i == wdth-1))) {
+	      torus_edges[l.slot(i,j,k)] = 1;
+	    }
+	  }
+	}
       }
+    });
+}
+
+/*!
+  Allocates the buffers for field and near_bombs, or takes them from the
+  pool
+*/
+void Minefield::allocateBuffers(const size_t slots) {
+  field = allocateBuffer(slots, field_capacity);
+  near_bombs = allocateBuffer(slots, count_capacity);
+}
+
+/*!
+  Allocates a buffer with room for slots slots, or takes one from the
+  pool.  It starts with a reference count, which forks share.
+*/
+mf_cell_t *Minefield::allocateBuffer(const size_t slots, size_t &capacity) {
+  size_t bytes = BUFFER_HEADER + slots;
+  unsigned char *buffer;
+  if (buffer_pool) {
+    buffer = buffer_pool->take(bytes, bytes);
+  } else {
+    buffer = new unsigned char[bytes];
+  }
+  new (buffer) size_t(1);
+  capacity = bytes - BUFFER_HEADER;
+  return buffer + BUFFER_HEADER;
+}
+
+/*!
+  Lets go of the arrays.  The last board using each frees it, or gives
+  it back to the pool.
+*/
+void Minefield::releaseBuffers() {
+  if (field) {
+    dropBuffer(field, field_capacity);
+    dropBuffer(near_bombs, count_capacity);
+  }
+  field = 0;
+  near_bombs = 0;
+  field_capacity = count_capacity = 0;
+}
+
+void Minefield::dropBuffer(mf_cell_t *cells, const size_t capacity) {
+  if (__atomic_sub_fetch(bufferRefs(cells), 1, __ATOMIC_ACQ_REL) == 0) {
+    unsigned char *buffer = cells - BUFFER_HEADER;
+    if (buffer_pool) {
+      buffer_pool->give(buffer, BUFFER_HEADER + capacity);
+    } else {
+      delete[] buffer;
     }
   }
+}
 
-  // Now populate it
-  for (int bn = 0; bn<n;++bn) {
-    size_t tx;
-    size_t ty;
-    size_t tz;
+/*!
+  Returns true if a fork, or the board this was forked from, is still
+  using the same field or near_bombs
+*/
+bool Minefield::sharesBuffers() const {
+  return bufferShared(field) || bufferShared(near_bombs);
+}
+
+/*!
+  Called before anything changes field.  If it's shared, this board gets
+  its own copy, so the boards it shares it with don't see the change.
+  The copy is the whole of field, one byte a slot, however few cells
+  the operation changes.  Everything that changes the board calls it
+  once per operation, so the loops themselves don't check.
+*/
+void Minefield::ownBuffers() {
+  if (!bufferShared(field)) return;
+
+  mf_cell_t *shared_field = field;
+  size_t shared_capacity = field_capacity;
+  field = allocateBuffer(total_slots, field_capacity);
+  std::copy(shared_field, shared_field+total_slots, field);
+
+  // The other boards may have let go of the shared buffer since it was
+  // checked, in which case it's this board's to free
+  dropBuffer(shared_field, shared_capacity);
+}
 
-    // Find clear spot
-    do {
-      tx = rand()%w;
-      ty = rand()%h;
-      tz = rand()%d;
-    } while (state(tx,ty,tz) == closed_bomb);
-    
-    state(tx,ty,tz) = closed_bomb;
+/*!
+  ownBuffers() for near_bombs, which only changes when the neighborhood
+  does
+*/
+void Minefield::ownCounts() {
+  if (!bufferShared(near_bombs)) return;
+
+  unsigned char *shared_counts = near_bombs;
+  size_t shared_capacity = count_capacity;
+  near_bombs = allocateBuffer(total_slots, count_capacity);
+  std::copy(shared_counts, shared_counts+total_slots, near_bombs);
+  dropBuffer(shared_counts, shared_capacity);
+}
+
+/*!
+  placeMines() clears the field and populates it with placeMinesFloyd(),
+  as FixedMinefield does.
+*/
+template <class L>
+void Minefield::placeMines(const L &l) {
+  placeMinesFloyd(l, field, total_slots, BORDER_CELL, wdth, hght, dpth, num_bombs, rng_seed);
+}
+
+/*!
+  placeMinesParallel() is used for big boards.  Every cell gets a random
+  key from Philox keyed by the seed and counted by the cell index, and the
+  mines are the num_bombs cells with the smallest (key, index) pairs.
+  That depends on nothing but the seed, so the board comes out the same
+  whatever the number of threads (but differs from what placeMines()
+  would give for the same seed).
+
+  The cut-off pair is found without sorting: a histogram of the top 16
+  bits of the keys finds the bucket it's in, and only that bucket's cells
+  (about 1 in 65536) are collected and sorted.  Slabs of z planes are
+  handed out to parallelFor()'s pooled threads for both passes, so the
+  placement starts no threads of its own.
+*/
+template <class L>
+void Minefield::placeMinesParallel(const L &l) {
+  static const size_t BUCKETS = 1<<16;
+  size_t plane = wdth*hght;
+  size_t slab_planes = (SLAB_CELLS+plane-1)/plane;
+  size_t slabs = (dpth+slab_planes-1)/slab_planes;
+  unsigned threads = workerThreads();
+  uint64_t key = rng_seed;
+
+  // Pass one: count the keys in each bucket
+  std::vector<std::vector<size_t> > counts(threads, std::vector<size_t>(BUCKETS, 0));
+  parallelFor(slabs, threads, [&](size_t s, unsigned worker) {
+      size_t begin = s*slab_planes*plane;
+      size_t end = std::min(total_cells, begin+slab_planes*plane);
+      std::vector<size_t> &c = counts[worker];
+      for (size_t i=begin; i<end; ++i) {
+	++c[philox64(i, key) >> 48];
+      }
+    });
+
+  // Find the bucket holding the num_bombs'th smallest key, and how many
+  // mines come from it
+  size_t below = 0;
+  size_t cut = 0;
+  if (num_bombs > 0) {
+    for (;; ++cut) {
+      size_t in_bucket = 0;
+      for (unsigned t=0; t<threads; ++t) {
+	in_bucket += counts[t][cut];
+      }
+      if (below+in_bucket >= size_t(num_bombs)) break;
+      below += in_bucket;
+    }
+  }
+  size_t need = num_bombs-below;
+
+  // Pass two: fill in the field, collecting the cells in the cut bucket
+  typedef std::pair<uint64_t, size_t> keyed_cell;
+  std::vector<std::vector<keyed_cell> > edge(threads);
+  std::fill(field, field+total_slots, BORDER_CELL);
+  parallelFor(slabs, threads, [&](size_t s, unsigned worker) {
+      size_t z_end = std::min(dpth, (s+1)*slab_planes);
+      for (size_t z=s*slab_planes; z<z_end; ++z) {
+	for (size_t y=0; y<hght; ++y) {
+	  size_t i = cellIndex(0,y,z);
+	  for (size_t x=0; x<wdth; ++x, ++i) {
+	    uint64_t k = philox64(i, key);
+	    size_t bucket = k >> 48;
+	    field[l.slot(x,y,z)] = (bucket < cut) ? closed_bomb : closed;
+	    if (bucket == cut && need > 0) {
+	      edge[worker].push_back(keyed_cell(k, i));
+	    }
+	  }
+	}
+      }
+    });
+
+  // Sorting the (key, index) pairs makes the choice independent of which
+  // thread found each one
+  std::vector<keyed_cell> candidates;
+  for (unsigned t=0; t<threads; ++t) {
+    candidates.insert(candidates.end(), edge[t].begin(), edge[t].end());
+  }
+  std::sort(candidates.begin(), candidates.end());
+  for (size_t i=0; i<need; ++i) {
+    size_t x, y, z;
+    cellPosition(candidates[i].second, x, y, z);
+    field[l.slot(x,y,z)] = closed_bomb;
   }
-  
 }
 
 /*!
   Deallocates the minefield
 */
 Minefield::~Minefield() {
-  delete[] field;
+  releaseStorage();
+}
+
+/*!
+  Lets go of the arrays and gives the scratch space back to the pool
+*/
+void Minefield::releaseStorage() {
+  releaseBuffers();
+  if (buffer_pool) {
+    buffer_pool->giveVector(touch_queue);
+    buffer_pool->giveVector(change_list);
+    buffer_pool->giveVector(region_label);
+    buffer_pool->giveVector(region_start);
+    buffer_pool->giveVector(region_cells);
+    buffer_pool->giveVector(region_tainted);
+    buffer_pool->giveVector(torus_edges);
+  }
 }
 
 /*!
   Returns the current state of the given cell.
 */
 mf_state_t Minefield::getState(const size_t x, const size_t y, const size_t z) {
-  return state(x,y,z);
+  return mf_state_t(__atomic_load_n(&state(x,y,z), __ATOMIC_RELAXED));
 }
 
 /*!
   Returns the number of mines remaining.
 */
 int Minefield::minesRemaining() {
-  return (num_bombs-(fake_marks+real_marks));
+  return (num_bombs-(__atomic_load_n(&fake_marks, __ATOMIC_RELAXED)
+		     +__atomic_load_n(&real_marks, __ATOMIC_RELAXED)));
 }
 
 /*!
   state() is used by the Minefield class to access individual mine cells.
+  Cells are stored as single bytes rather than as mf_state_t, which is
+  usually the size of an int.
   All access to the field array (except allocation/deallocation) should go through
   this function.
 */
-inline mf_state_t &Minefield::state(const size_t x, const size_t y, const size_t z) {
+inline mf_cell_t &Minefield::state(const size_t x, const size_t y, const size_t z) {
   if (x<wdth && y<hght && z < dpth)
-    return field[(wdth*hght*z)+wdth*y+x];
+    return field[slot(x,y,z)];
   else
     throw std::runtime_error("Invalid index");
 }
 
+/*!
+  Atomically changes a cell from closed to open.  Returns false if the
+  cell wasn't closed or another thread got there first.
+*/
+static inline bool claimCell(mf_cell_t &cell) {
+  if (__atomic_load_n(&cell, __ATOMIC_RELAXED) != closed) return false;
+  mf_cell_t expected = closed;
+  return __atomic_compare_exchange_n(&cell, &expected, mf_cell_t(open), false,
+				     __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/*!
+  Returns the slot of a cell in the layout in use
+*/
+size_t Minefield::slot(const size_t x, const size_t y, const size_t z) const {
+  return withLayout([&](const auto &l) { return l.slot(x,y,z); });
+}
+
 /*!
   touch() should be called when the user clicks on a cell.
-  The function recursively clears the clicked cell and the surrounding cells.
   If the cell is not a bomb, it's state is set to open.
-  If the cell is not near any bombs, its neighbors on the top, bottom,
-  front, back, left, and right are also touched.
+  If the cell is not near any bombs, all 26 of its neighbors are opened
+  too, and so on until the whole empty region and its numbered border
+  are open.
+
+  The flood fill is iterative: cells are opened as they are queued, so
+  each one is visited once, and the queue is kept between calls so
+  repeated clicks don't allocate.  On big boards, if the opening is
+  still spreading after PARALLEL_CASCADE_CELLS cells, the rest of it is
+  handed to cascadeParallel().
 
-  The function returns number of opened cells.
+  The function returns number of opened cells, and changes() lists them.
 */
 size_t Minefield::touch(const size_t x, const size_t y, const size_t z) {
   
@@ -110,102 +695,727 @@ size_t Minefield::touch(const size_t x, const size_t y, const size_t z) {
     throw std::runtime_error("Invalid index");
   }
 
+  if (concurrent) return touchConcurrent(x,y,z);
+
+  ownBuffers();
+  change_list.clear();
+  touch_queue.clear();
+
   // Check for a bomb
   if (state(x,y,z) != closed) return 0;
 
-  // Valid index, and not a bomb, so open it
-  size_t retVal = 0;
-  state(x,y,z) = open;
-  ++num_cleared;
-  ++retVal;
-
-  // Now try the neighbors
-  size_t bn = bombsNear(x,y,z);
-
-  if (bn ==0) {
-    for (int xinc = -1; xinc <= 1; xinc += 1) {
-      for (int yinc = -1; yinc <= 1; yinc += 1) {
-	for (int zinc = -1; zinc <= 1; zinc += 1) {
-	  size_t nx = x + xinc;
-	  size_t ny = y + yinc;
-	  size_t nz = z + zinc;
-
-	  if ((nx < wdth) &&
-	      (ny < hght) &&
-	      (nz < dpth)) {
-	    retVal += touch(nx, ny, nz);
+  // Valid index, and not a bomb, so open it and spread out from there
+  size_t opened = withLayout([&](const auto &l) { return cascade(l, l.slot(x,y,z)); });
+  recordOpened();
+  return opened;
+}
+
+/*!
+  touchMany() touches each of the cells, given by linear index, in turn,
+  as if touch() had been called on each.  Every index is checked before
+  anything changes.  Bombs are skipped, as touch() skips them, so check
+  for them first if they should end the game.
+  It returns the total number of cells opened, and changes() lists them
+  all.  It writes cells without claiming them, so it can't be used in
+  concurrent mode.
+*/
+size_t Minefield::touchMany(const std::vector<size_t> &cells) {
+  if (concurrent) {
+    throw std::runtime_error("No touchMany() in concurrent mode");
+  }
+  checkIndices(cells);
+
+  ownBuffers();
+  change_list.clear();
+  touch_queue.clear();
+
+  size_t opened = withLayout([&](const auto &l) {
+      size_t total = 0;
+      for (size_t i=0; i<cells.size(); ++i) {
+	size_t x, y, z;
+	cellPosition(cells[i], x, y, z);
+	size_t s = l.slot(x,y,z);
+	if (field[s] == closed) {
+	  total += cascade(l, s);
+	}
+      }
+      return total;
+    });
+  recordOpened();
+  return opened;
+}
+
+/*!
+  chord() is the shortcut for opening around a numbered cell.  If the
+  cell is open and exactly as many of its neighbors are marked as there
+  are bombs near it, every unmarked neighbor is touched.
+  If the marks were wrong, one of those neighbors is a bomb; it's left
+  closed, and *hit_bomb is set so the caller can end the game.
+  It returns the number of cells opened, and changes() lists them.  Like
+  touchMany(), it can't be used in concurrent mode.
+*/
+size_t Minefield::chord(const size_t x, const size_t y, const size_t z, bool *hit_bomb) {
+  if (concurrent) {
+    throw std::runtime_error("No chord() in concurrent mode");
+  }
+  if (x >= wdth || y >= hght || z >= dpth) {
+    throw std::runtime_error("Invalid index");
+  }
+
+  ownBuffers();
+  change_list.clear();
+  touch_queue.clear();
+  if (hit_bomb) *hit_bomb = false;
+
+  size_t opened = withLayout([&](const auto &l) {
+      size_t s = l.slot(x,y,z);
+      if (field[s] != open) return size_t(0);
+
+      size_t marks = 0;
+      l.forEachNeighbor(s, [&](size_t n) {
+	  marks += (field[n] == marked_empty || field[n] == marked_bomb);
+	});
+      if (marks != near_bombs[s]) return size_t(0);
+
+      size_t total = 0;
+      l.forEachNeighbor(s, [&](size_t n) {
+	  if (field[n] == closed) {
+	    total += cascade(l, n);
+	  } else if (field[n] == closed_bomb && hit_bomb) {
+	    *hit_bomb = true;
 	  }
+	});
+      return total;
+    });
+  recordOpened();
+  return opened;
+}
+
+/*!
+  cascade() is touch()'s flood fill, starting from a closed cell that
+  isn't a bomb.  It returns the number of cells opened, adds them to
+  num_cleared and appends them to touch_queue.
+*/
+template <class L>
+size_t Minefield::cascade(const L &l, const size_t start) {
+  size_t first = touch_queue.size();
+
+  // An empty cell in a labelled opening opens the whole opening, straight
+  // from its list
+  if (!region_start.empty() && near_bombs[start] == 0) {
+    uint32_t r = region_label[start];
+    if (!region_tainted[r]) {
+      for (size_t i=region_start[r]; i<region_start[r+1]; ++i) {
+	size_t s = region_cells[i];
+	if (field[s] == closed) {
+	  field[s] = open;
+	  touch_queue.push_back(s);
+	}
+      }
+      size_t opened = touch_queue.size()-first;
+      num_cleared += opened;
+      return opened;
+    }
+  }
+
+  field[start] = open;
+  touch_queue.push_back(start);
+
+  // A big opening is handed to cascadeParallel() once it's clearly big
+  bool may_go_parallel = total_cells >= PARALLEL_CELLS && workerThreads() > 1;
+  size_t stop = may_go_parallel ? first+PARALLEL_CASCADE_CELLS : total_cells;
+  size_t head = floodOpen(l, field, near_bombs, touch_queue, first, stop);
+  if (head < touch_queue.size()) {
+    cascadeParallel(l, head);
+  }
+
+  size_t opened = touch_queue.size()-first;
+  num_cleared += opened;
+  return opened;
+}
+
+/*!
+  Adds the cells in touch_queue, which have all just been opened, to
+  changes() and the journal, and marks their rows for runs().
+*/
+void Minefield::recordOpened() {
+  if (journal_limit > 0 && !touch_queue.empty()) {
+    startJournalOp();
+    mf_journal_op_t &op = journal_ops.back();
+    for (size_t i=0; i<touch_queue.size(); ++i) {
+      mf_journal_entry_t entry = {touch_queue[i], closed, open};
+      journal.push_back(entry);
+    }
+    op.cleared += touch_queue.size();
+    endJournalOp();
+  }
+
+  if (!record_changes && runs_stale) return;
+
+  size_t first = change_list.size();
+  if (record_changes) {
+    change_list.resize(first+touch_queue.size());
+  }
+  withLayout([&](const auto &l) {
+      for (size_t i=0; i<touch_queue.size(); ++i) {
+	size_t x, y, z;
+	l.position(touch_queue[i], x, y, z);
+	size_t index = cellIndex(x,y,z);
+	rowChanged(index);
+	if (record_changes) {
+	  change_list[first+i].index = index;
+	  change_list[first+i].state = open;
 	}
       }
+    });
+}
+
+/*!
+  Throws if any of the linear indices is off the board.
+*/
+void Minefield::checkIndices(const std::vector<size_t> &cells) const {
+  for (size_t i=0; i<cells.size(); ++i) {
+    if (cells[i] >= total_cells) {
+      throw std::runtime_error("Invalid index");
     }
   }
-    
-//   if (bn==0) {
-//     if (wdth>(x+1)) {
-//       retVal += touch(x+1, y, z);
-//       if (hght>(y+1)) {
-// 	retVal += touch(x+1, y+1, z);
-// 	if (
-//       }
-//     }
+}
+
+/*!
+  cascadeParallel() finishes a flood fill with a level synchronous
+  breadth first search.  touch_queue[head...] is the current frontier: cells
+  that are open but haven't had their neighbors checked.  Each level's
+  frontier is split into blocks that the worker threads share out, and a
+  thread opens a neighbor only if its compare-and-swap from closed to open
+  succeeds, so no cell is opened or counted twice.  The cells each thread
+  opens become the next level's frontier and are appended to touch_queue,
+  so afterwards it holds every opened cell, as in the serial case.
+*/
+template <class L>
+void Minefield::cascadeParallel(const L &l, size_t head) {
+  unsigned threads = workerThreads();
+  if (cascade_next.size() < threads) {
+    cascade_next.resize(threads);
+  }
+
+  while (head < touch_queue.size()) {
+    size_t level_end = touch_queue.size();
+    size_t blocks = (level_end-head+CASCADE_BLOCK-1)/CASCADE_BLOCK;
 
+    parallelFor(blocks, threads, [&](size_t b, unsigned worker) {
+	std::vector<size_t> &next = cascade_next[worker];
+	size_t begin = head + b*CASCADE_BLOCK;
+	size_t end = std::min(level_end, begin+CASCADE_BLOCK);
+	for (size_t i=begin; i<end; ++i) {
+	  size_t s = touch_queue[i];
+	  if (near_bombs[s] != 0) continue;
 
-    
-//     if ((x-1)<wdth)
-//       retVal += touch(x-1,y,z);
-    
-//     if (hght>(y+1))
-//       retVal += touch(x,y+1,z);
-    
-//     if ((y-1)<hght)
-//       retVal += touch(x,y-1,z);
-    
-//     if (dpth>(z+1))
-//       retVal += touch(x,y,z+1);
-    
-//     if ((z-1)<dpth)
-//       retVal += touch(x,y,z-1);
+	  l.forEachNeighbor(s, [&](size_t n) {
+	      if (claimCell(field[n])) {
+		next.push_back(n);
+	      }
+	    });
+	}
+      });
 
-  return retVal;
+    head = level_end;
+    for (unsigned t=0; t<threads; ++t) {
+      touch_queue.insert(touch_queue.end(), cascade_next[t].begin(), cascade_next[t].end());
+      cascade_next[t].clear();
+    }
+  }
 }
 
 /*!
   bombsNear() returns the number of bombs near the given cell.
+  The counts never change once the mines are placed, so they're looked up
+  in the table built by countNeighbors().
 */
 size_t Minefield::bombsNear(const size_t x, const size_t y, const size_t z) {
+  if (x >= wdth || y >= hght || z >= dpth) {
+    throw std::runtime_error("Invalid index");
+  }
+  return near_bombs[slot(x,y,z)];
+}
 
-  // (x_min, y_min, z_min) is the minimum cell index to check
-  // (x_max, y_max, z_max is the maximum cell index to check
-  size_t x_min = x-1;
-  size_t x_max = x+1;
+/*!
+  Steps v by dv along an axis of n cells, wrapping around on a torus as
+  TorusTopology does.  Returns false if that's off the board.
+*/
+static inline bool stepAxis(const size_t v, const int dv, const size_t n, const bool wrap, size_t &out) {
+  if (dv < 0 && v == 0) {
+    out = n-1;
+    return wrap && n >= 3;
+  }
+  if (dv > 0 && v == n-1) {
+    out = 0;
+    return wrap && n >= 3;
+  }
+  out = v + dv;
+  return true;
+}
 
-  if (x_min>x) x_min = x;
-  if (x_max>=wdth) x_max = x;
+template <class S>
+static size_t stencilIndices(const size_t x, const size_t y, const size_t z,
+			     const size_t w, const size_t h, const size_t d,
+			     const bool wrap, size_t *out) {
+  // Cells away from the faces just add fixed steps
+  if (x > 0 && x+1 < w && y > 0 && y+1 < h && z > 0 && z+1 < d) {
+    size_t index = x + w*(y + h*z);
+    for (size_t i=0; i<S::SIZE; ++i) {
+      size_t k = S::index(i);
+      out[i] = index + neighborDX(k) + ptrdiff_t(w)*(neighborDY(k) + ptrdiff_t(h)*neighborDZ(k));
+    }
+    return S::SIZE;
+  }
 
-  size_t y_min = y-1;
-  size_t y_max = y+1;
-  if (y_min>y) y_min = y;
-  if (y_max>=hght) y_max = y;
-  
-  size_t z_min = z-1;
-  size_t z_max = z+1;
-  if (z_min>z) z_min = z;
-  if (z_max>=dpth) z_max = z;
-  
-  size_t numBombs = 0;
-
-  // Loop from minimum to maximum, check for bombs
-  for (size_t i=x_min; i<=x_max;++i) {
-    for (size_t j=y_min; j<=y_max; ++j) {
-      for (size_t k=z_min; k<=z_max; ++k) {
-	if (state(i,j,k)==closed_bomb ||
-	    state(i,j,k)==marked_bomb) {
-	  ++numBombs;
+  size_t count = 0;
+  for (size_t i=0; i<S::SIZE; ++i) {
+    size_t k = S::index(i), nx, ny, nz;
+    if (stepAxis(x, neighborDX(k), w, wrap, nx) && stepAxis(y, neighborDY(k), h, wrap, ny)
+	&& stepAxis(z, neighborDZ(k), d, wrap, nz)) {
+      out[count++] = nx + w*(ny + h*nz);
+    }
+  }
+  return count;
+}
+
+/*!
+  neighborIndices() is for code outside the board, like the solver, that
+  needs the same neighbors the counts were made with, by linear index.
+*/
+size_t Minefield::neighborIndices(const size_t index, size_t *out) const {
+  if (index >= total_cells) {
+    throw std::runtime_error("Invalid index");
+  }
+
+  size_t x, y, z;
+  cellPosition(index, x, y, z);
+  bool wrap = (cell_topology == torus_topology);
+  switch (cell_stencil) {
+  case edge_stencil:
+    return stencilIndices<EdgeStencil>(x, y, z, wdth, hght, dpth, wrap, out);
+  case face_stencil:
+    return stencilIndices<FaceStencil>(x, y, z, wdth, hght, dpth, wrap, out);
+  default:
+    return stencilIndices<CornerStencil>(x, y, z, wdth, hght, dpth, wrap, out);
+  }
+}
+
+/*!
+  runs() is for renderers and tools that look at the whole board.  It
+  returns the runs of cells, along x, that look the same to the player,
+  for just the views asked for; a renderer asks for VISIBLE_RUNS and
+  never sees the cleared cells it has nothing to draw for, however much
+  of the board they cover.
+
+  The runs come from row summaries that are built on the first call,
+  and after that only the rows that have changed since the last call
+  are summarized again, so drawing the board after a click costs about
+  as much as the rows it changed.  In concurrent mode runs() must not be
+  called while other threads change the board.
+*/
+MinefieldRuns Minefield::runs(const unsigned views) {
+  if (runs_stale) {
+    summarizeRows();
+  } else {
+    summarizeChangedRows();
+  }
+
+  size_t rows = hght*dpth;
+  return MinefieldRuns(MinefieldRunIterator(run_list.data(), row_first.data(), row_last.data(),
+					    row_views.data(), rows, hght, views, 0),
+		       MinefieldRunIterator(run_list.data(), row_first.data(), row_last.data(),
+					    row_views.data(), rows, hght, views, rows));
+}
+
+/*!
+  Summarizes every row, starting run_list afresh.
+*/
+void Minefield::summarizeRows() {
+  size_t rows = hght*dpth;
+  run_list.clear();
+  row_first.resize(rows+1);
+  row_last.resize(rows);
+  row_views.assign(rows, 0);
+  row_changed.assign(rows, 0);
+  old_runs = 0;
+
+  std::vector<unsigned char> views(wdth);
+  withLayout([&](const auto &l) {
+      for (size_t k=0; k<dpth; ++k) {
+	for (size_t j=0; j<hght; ++j) {
+	  summarizeRow(l, j, k, views.data());
 	}
       }
+    });
+  row_first[rows] = run_list.size();
+  runs_stale = false;
+}
+
+/*!
+  Summarizes the rows marked in row_changed again.  Their old runs are
+  left where they are in run_list, unused, until there are as many of
+  them as runs in use, when it's cheaper to start again.
+*/
+void Minefield::summarizeChangedRows() {
+  size_t rows = hght*dpth;
+  std::vector<unsigned char> views;
+  withLayout([&](const auto &l) {
+      for (size_t r=0; r<rows; ++r) {
+	if (!row_changed[r]) continue;
+	row_changed[r] = 0;
+	views.resize(wdth);
+	old_runs += row_last[r] - row_first[r];
+	summarizeRow(l, r % hght, r / hght, views.data());
+      }
+    });
+  row_first[rows] = run_list.size();
+
+  if (2*old_runs > run_list.size()) {
+    summarizeRows();
+  }
+}
+
+/*!
+  Each row is classified a whole row at a time, with no branches, into
+  views, a scratch row, which is then cut into runs at the end of
+  run_list.
+*/
+template <class L>
+void Minefield::summarizeRow(const L &l, const size_t j, const size_t k, unsigned char *views) {
+  for (size_t i=0; i<wdth; ++i) {
+    size_t s = l.slot(i,j,k);
+    mf_cell_t cell = field[s];
+    unsigned char hidden = (cell == closed || cell == closed_bomb) ? closed_view : marked_view;
+    unsigned char shown = near_bombs[s] ? numbered_view : cleared_view;
+    views[i] = (cell == open) ? shown : hidden;
+  }
+
+  size_t r = j + hght*k;
+  row_first[r] = run_list.size();
+  unsigned char seen = 0;
+  for (size_t i=0, start=0; i<wdth; start=i) {
+    unsigned char v = views[i];
+    while (i < wdth && views[i] == v) ++i;
+    mf_row_run_t run = {start, i-start, mf_view_t(v)};
+    run_list.push_back(run);
+    seen |= 1u << v;
+  }
+  row_last[r] = run_list.size();
+  row_views[r] = seen;
+}
+
+/*!
+  Concurrent touch() and mark() can mark rows from several threads at
+  once, so the mark is an atomic store.  Nothing is marked until runs()
+  has built the summaries.
+*/
+void Minefield::rowChanged(const size_t index) {
+  if (runs_stale) return;
+  __atomic_store_n(&row_changed[index/wdth], 1, __ATOMIC_RELAXED);
+}
+
+/*!
+  Box-sums an array of 0/1 bomb flags in the padded row major layout, in
+  place; the border has no bombs, so the counts inside it come out right.
+  Big boards are split into slabs of z planes that are counted in
+  parallel; each slab gets copies of the planes on either side of it,
+  since its neighbors overwrite those in place.
+*/
+static void countPadded(unsigned char *flags, const PaddedLayout &l, bool parallel) {
+  size_t pad_w = l.paddedWidth(), pad_h = l.paddedHeight(), pad_d = l.paddedDepth();
+  if (!parallel) {
+    countBombsNear(flags, pad_w, pad_h, pad_d);
+    return;
+  }
+
+  // Fewer, bigger slabs for counting keep the copied planes down
+  size_t plane = pad_w*pad_h;
+  size_t count_slabs = std::min(pad_d, size_t(workerThreads())*4);
+  size_t count_planes = (pad_d+count_slabs-1)/count_slabs;
+  count_slabs = (pad_d+count_planes-1)/count_planes;
+  std::vector<unsigned char> edges(2*count_slabs*plane);
+  for (size_t s=0; s<count_slabs; ++s) {
+    size_t z0 = s*count_planes;
+    size_t z1 = std::min(pad_d, z0+count_planes);
+    if (z0 > 0) {
+      std::copy(flags+(z0-1)*plane, flags+z0*plane, &edges[2*s*plane]);
+    }
+    if (z1 < pad_d) {
+      std::copy(flags+z1*plane, flags+(z1+1)*plane, &edges[(2*s+1)*plane]);
+    }
+  }
+  parallelFor(count_slabs, [&](size_t s, unsigned) {
+      size_t z0 = s*count_planes;
+      size_t z1 = std::min(pad_d, z0+count_planes);
+      countBombsNearPlanes(flags, pad_w, pad_h, z0, z1,
+			   (z0 > 0) ? &edges[2*s*plane] : 0,
+			   (z1 < pad_d) ? &edges[(2*s+1)*plane] : 0);
+    });
+}
+
+/*!
+  Fills the border of an array of bomb flags in the padded row major
+  layout with copies of the opposite faces of the board, so the box sum
+  counts a torus's neighbors across the edges.  The x ends of each row
+  are copied first, then whole rows, then whole planes, so the border's
+  edges and corners pick up the cells diagonally opposite.  Axes shorter
+  than 3 cells don't wrap (see TorusTopology), so their border stays 0.
+*/
+static void wrapPadded(unsigned char *flags, const PaddedLayout &l,
+		       size_t w, size_t h, size_t d) {
+  size_t pad_w = l.paddedWidth(), pad_h = l.paddedHeight();
+  size_t plane = pad_w*pad_h;
+  if (w >= 3) {
+    for (size_t k=1; k<=d; ++k) {
+      for (size_t j=1; j<=h; ++j) {
+	unsigned char *row = flags + pad_w*(j + pad_h*k);
+	row[0] = row[w];
+	row[w+1] = row[1];
+      }
+    }
+  }
+  if (h >= 3) {
+    for (size_t k=1; k<=d; ++k) {
+      unsigned char *p = flags + plane*k;
+      std::copy(p+pad_w*h, p+pad_w*(h+1), p);
+      std::copy(p+pad_w, p+2*pad_w, p+pad_w*(h+1));
+    }
+  }
+  if (d >= 3) {
+    std::copy(flags+plane*d, flags+plane*(d+1), flags);
+    std::copy(flags+plane, flags+2*plane, flags+plane*(d+1));
+  }
+}
+
+/*!
+  countNeighbors() fills in the near_bombs table.  It marks each bomb with
+  a 1 and then lets countBombsNear() box-sum the whole board.  In the row
+  major layout that happens in place in near_bombs; other layouts are
+  counted in a row major copy and then copied back.  On a torus the
+  border is filled in from the other side of the board first.
+  Like the original per-cell scan, a bomb counts towards its own cell.
+  The box sum only fits the 26 neighbor stencil; the others are counted
+  by countStencil().
+*/
+void Minefield::countNeighbors() {
+  if (cell_stencil != corner_stencil) {
+    withLayout([&](const auto &l) { countStencil(l); });
+    return;
+  }
+
+  bool parallel = total_cells >= PARALLEL_CELLS;
+  bool torus = cell_topology == torus_topology;
+  size_t plane = padded.paddedWidth()*padded.paddedHeight();
+  size_t slab_planes = (SLAB_CELLS+plane-1)/plane;
+  size_t slabs = (padded.paddedDepth()+slab_planes-1)/slab_planes;
+
+  if (cell_layout == row_major_layout) {
+    parallelFor(parallel ? slabs : 1, [&](size_t s, unsigned) {
+	size_t begin = parallel ? s*slab_planes*plane : 0;
+	size_t end = parallel ? std::min(total_slots, begin+slab_planes*plane) : total_slots;
+	for (size_t i=begin; i<end; ++i) {
+	  near_bombs[i] = (field[i] == closed_bomb || field[i] == marked_bomb);
+	}
+      });
+    if (torus) {
+      wrapPadded(near_bombs, padded, wdth, hght, dpth);
+    }
+    countPadded(near_bombs, padded, parallel);
+    return;
+  }
+
+  std::vector<unsigned char> flags(padded.slots(), 0);
+  withLayout([&](const auto &l) {
+      for (size_t k=0; k<dpth; ++k) {
+	for (size_t j=0; j<hght; ++j) {
+	  for (size_t i=0; i<wdth; ++i) {
+	    mf_cell_t cell = field[l.slot(i,j,k)];
+	    flags[padded.slot(i,j,k)] = (cell == closed_bomb || cell == marked_bomb);
+	  }
+	}
+      }
+      if (torus) {
+	wrapPadded(&flags[0], padded, wdth, hght, dpth);
+      }
+      countPadded(&flags[0], padded, parallel);
+
+      std::fill(near_bombs, near_bombs+total_slots, 0);
+      for (size_t k=0; k<dpth; ++k) {
+	for (size_t j=0; j<hght; ++j) {
+	  for (size_t i=0; i<wdth; ++i) {
+	    near_bombs[l.slot(i,j,k)] = flags[padded.slot(i,j,k)];
+	  }
+	}
+      }
+    });
+}
+
+/*!
+  countStencil() fills in the near_bombs table for the 18 and 6 neighbor
+  stencils, by counting each cell's neighbors through the layout l.  The
+  stencil's loop is unrolled, so it's a handful of loads a cell; big
+  boards are counted in slabs of z planes on all cores.
+*/
+template <class L>
+void Minefield::countStencil(const L &l) {
+  bool parallel = total_cells >= PARALLEL_CELLS;
+  size_t plane = wdth*hght;
+  size_t slab_planes = parallel ? (SLAB_CELLS+plane-1)/plane : dpth;
+  size_t slabs = (dpth+slab_planes-1)/slab_planes;
+
+  // Stores to near_bombs could change field as far as the compiler
+  // knows, so a local copy saves reloading it for every neighbor
+  const mf_cell_t *cells = field;
+  std::fill(near_bombs, near_bombs+total_slots, 0);
+  parallelFor(slabs, [&](size_t sl, unsigned) {
+      size_t z_end = std::min(dpth, (sl+1)*slab_planes);
+      for (size_t k=sl*slab_planes; k<z_end; ++k) {
+	for (size_t j=0; j<hght; ++j) {
+	  for (size_t i=0; i<wdth; ++i) {
+	    size_t s = l.slot(i,j,k);
+	    unsigned count = (cells[s] == closed_bomb || cells[s] == marked_bomb);
+	    l.forEachNeighbor(s, [&](size_t n) {
+		count += (cells[n] == closed_bomb || cells[n] == marked_bomb);
+	      });
+	    near_bombs[s] = (unsigned char)count;
+	  }
+	}
+      }
+    });
+}
+
+/*!
+  setNeighborhood() picks the stencil (which cells are neighbors) and
+  the topology (whether the board wraps around) for this game and the
+  ones reset() starts, and recounts the bombs near each cell for them.
+  It's meant to be called before the first move: cells already opened
+  or marked keep their states.  Each combination has its own compiled
+  loops (see withLayout()), so none of them pays for the choice cell by
+  cell.  It must not be called while other threads use the board.
+*/
+void Minefield::setNeighborhood(const mf_stencil_t stencil, const mf_topology_t topology) {
+  ownBuffers();
+  ownCounts();
+  runs_stale = true;
+  cell_stencil = stencil;
+  cell_topology = topology;
+  findTorusEdges();
+  countNeighbors();
+
+  bool labelled = !region_start.empty();
+  clearRegions();
+  if (labelled) {
+    withLayout([&](const auto &l) { labelRegions(l); });
+  }
+}
+
+/*!
+  setRegionLabels() turns the precomputed openings on or off, for this
+  game and the ones reset() starts.  They're on by default.  Labelling
+  costs about as much as opening every region on the board, but it's
+  done when the board is generated instead of when it's clicked.
+  Boards with fewer than REGION_MIN_CELLS cells aren't labelled when
+  they're generated, since their flood fills are quick anyway, but
+  setRegionLabels(true) labels one.  Boards with more than REGION_CELLS
+  cells are never labelled, since it takes around 8 bytes a cell.
+*/
+void Minefield::setRegionLabels(const bool on) {
+  label_regions = on;
+  clearRegions();
+  if (on && total_cells <= REGION_CELLS) {
+    withLayout([&](const auto &l) { labelRegions(l); });
+  }
+}
+
+/*!
+  Forgets the openings, keeping the memory for next time
+*/
+void Minefield::clearRegions() {
+  region_label.clear();
+  region_start.clear();
+  region_cells.clear();
+  region_tainted.clear();
+}
+
+/*!
+  labelRegions() finds the openings: the connected groups of empty cells
+  (those with no bombs near them), each with the numbered cells around
+  it.  Opening any empty cell opens exactly its group, so cascade() can
+  open it from a list instead of searching.
+
+  Each opening is found by a flood fill from its lowest slot, which
+  writes its cells straight into region_cells, so region r is
+  region_cells[region_start[r]...region_start[r+1]].  A numbered cell goes
+  in every region it borders.
+
+  region_label holds each empty cell's region.  For numbered cells it
+  holds the last region that listed them, so they're listed once per
+  region.
+*/
+template <class L>
+void Minefield::labelRegions(const L &l) {
+  region_label.assign(total_slots, NO_REGION);
+  region_start.push_back(0);
+
+  for (size_t start=0; start<total_slots; ++start) {
+    if (near_bombs[start] != 0 || field[start] == BORDER_CELL || region_label[start] != NO_REGION) {
+      continue;
+    }
+
+    uint32_t r = uint32_t(region_start.size()-1);
+    size_t head = region_cells.size();
+    region_label[start] = r;
+    region_cells.push_back(uint32_t(start));
+    for (; head < region_cells.size(); ++head) {
+      size_t s = region_cells[head];
+      if (near_bombs[s] != 0) continue;
+
+      l.forEachNeighbor(s, [&](size_t n) {
+	  if (region_label[n] != r && field[n] != BORDER_CELL && field[n] != closed_bomb
+	      && field[n] != marked_bomb) {
+	    region_label[n] = r;
+	    region_cells.push_back(uint32_t(n));
+	  }
+	});
+    }
+    region_start.push_back(uint32_t(region_cells.size()));
+  }
+
+  // If the game's already going, regions with anything opened or marked
+  // might not open the same way as a flood fill would, so they don't use
+  // their lists
+  uint32_t regions = uint32_t(region_start.size()-1);
+  region_tainted.assign(regions, 0);
+  for (uint32_t r=0; r<regions; ++r) {
+    for (size_t i=region_start[r]; i<region_start[r+1]; ++i) {
+      if (field[region_cells[i]] != closed) {
+	region_tainted[r] = 1;
+	break;
+      }
     }
   }
-  return numBombs;
+}
+
+/*!
+  Called when a cell that isn't a bomb is marked.  A marked cell stops a
+  flood fill, so the openings it's in go back to using the flood fill.
+  It's in its own opening if it's empty, or those of its empty neighbors
+  if it's numbered.
+*/
+void Minefield::taintRegions(const size_t s) {
+  if (near_bombs[s] == 0) {
+    __atomic_store_n(&region_tainted[region_label[s]], 1, __ATOMIC_RELAXED);
+    return;
+  }
+  withLayout([&](const auto &l) {
+      l.forEachNeighbor(s, [&](size_t n) {
+	  if (near_bombs[n] == 0 && region_label[n] != NO_REGION) {
+	    __atomic_store_n(&region_tainted[region_label[n]], 1, __ATOMIC_RELAXED);
+	  }
+	});
+    });
 }
 
 /*!
@@ -215,12 +1425,13 @@ bool Minefield::hasWon() {
   // A "win" occurs when all bombs are marked and there are no closed cells
   
   //if (real_marks == num_bombs) return true;
-  if (num_cleared == (total_cells-num_bombs)) return true;
+  if (__atomic_load_n(&num_cleared, __ATOMIC_RELAXED) == (total_cells-num_bombs)) return true;
   return false;
 }
 
 /*!
-  mark() marks a cell as a bomb
+  mark() marks a cell as a bomb, or removes an existing mark.
+  changes() lists the cell if its state changed.
 */
 
 void Minefield::mark(const size_t x, const size_t y, const size_t z) {
@@ -229,27 +1440,291 @@ void Minefield::mark(const size_t x, const size_t y, const size_t z) {
     throw std::runtime_error("Invalid index");
   }
 
+  if (concurrent) {
+    markConcurrent(x,y,z);
+    return;
+  }
+
+  ownBuffers();
+  change_list.clear();
+  toggleMark(cellIndex(x,y,z));
+  endJournalOp();
+}
+
+/*!
+  markMany() marks or unmarks each of the cells, given by linear index,
+  in turn, as if mark() had been called on each.  Every index is checked
+  before anything changes.  changes() lists every cell that changed.
+  Like touchMany(), it can't be used in concurrent mode.
+*/
+void Minefield::markMany(const std::vector<size_t> &cells) {
+  if (concurrent) {
+    throw std::runtime_error("No markMany() in concurrent mode");
+  }
+  checkIndices(cells);
+
+  ownBuffers();
+  change_list.clear();
+  for (size_t i=0; i<cells.size(); ++i) {
+    toggleMark(cells[i]);
+  }
+  endJournalOp();
+}
+
+/*!
+  Does the work for mark() and markMany() on a valid linear index, adding
+  the cell to changes() if its state changed.
+*/
+void Minefield::toggleMark(const size_t index) {
+  size_t x, y, z;
+  cellPosition(index, x, y, z);
+  mf_cell_t &cell = field[slot(x,y,z)];
+  mf_cell_t before = cell;
+
   // New state depends on existing state...
-  mf_state_t cs = state(x,y,z);
-  switch (cs) {
-  case closed:
-    state(x,y,z) = marked_empty;
-    ++fake_marks;
-    break;
-  case closed_bomb:
-    state(x,y,z) = marked_bomb;
-    ++real_marks;
-    break;
-  case marked_empty:
-    state(x,y,z) = closed;
-    --fake_marks;
-    break;
-  case marked_bomb:
-    state(x,y,z) = closed_bomb;
-    --real_marks;
-    break;
-  default:
-    break;
+  mf_mark_change_t marking = markChange(cell);
+  if (marking.after == before) return;
+  cell = marking.after;
+  fake_marks += marking.fake;
+  real_marks += marking.real;
+
+  rowChanged(index);
+  if (record_changes) {
+    mf_change_t change = {index, mf_state_t(cell)};
+    change_list.push_back(change);
+  }
+
+  if (cell == marked_empty && !region_start.empty()) {
+    taintRegions(size_t(&cell-field));
+  }
+
+  if (journal_limit > 0) {
+    startJournalOp();
+    mf_journal_entry_t entry = {size_t(&cell-field), before, cell};
+    journal.push_back(entry);
+    mf_journal_op_t &op = journal_ops.back();
+    op.fake += marking.fake;
+    op.real += marking.real;
   }
 }
 
+/*!
+  setJournal() turns the journal on or off.  While it's on, every
+  operation that changes the board records each cell it changed, with
+  its states before and after, and the changes to the counters, so
+  undo() and redo() cost time in proportion to what the operation
+  changed.
+
+  limit caps the number of cell changes kept.  When the journal grows
+  past it, it's compacted: the oldest operations are dropped until it's
+  down to half the limit, so the board as it was then becomes the
+  checkpoint undo() stops at.  An operation that changes more cells than
+  that on its own can't be undone.  A limit of 0 turns the journal off;
+  changing the limit starts a fresh journal from the current board.
+
+  Concurrent touch() and mark() don't record anything, so the journal
+  can't be turned on in concurrent mode.
+*/
+void Minefield::setJournal(const size_t limit) {
+  if (concurrent && limit > 0) {
+    throw std::runtime_error("No journal in concurrent mode");
+  }
+  journal_limit = limit;
+  journal.clear();
+  journal_ops.clear();
+  journal_pos = 0;
+}
+
+/*!
+  Makes sure the journal has an operation in progress.  The first change
+  an operation makes throws away anything undone before it, since it
+  can't be redone any more.
+*/
+void Minefield::startJournalOp() {
+  if (journal_op_started) return;
+
+  if (journal_pos < journal_ops.size()) {
+    journal.resize(journal_ops[journal_pos].begin);
+    journal_ops.resize(journal_pos);
+  }
+  mf_journal_op_t op = {journal.size(), 0, 0, 0};
+  journal_ops.push_back(op);
+  journal_op_started = true;
+}
+
+/*!
+  Finishes the operation in progress, if it changed anything, and
+  compacts the journal if it's over the limit.
+*/
+void Minefield::endJournalOp() {
+  if (!journal_op_started) return;
+  journal_op_started = false;
+  journal_pos = journal_ops.size();
+
+  if (journal.size() <= journal_limit) return;
+
+  // Keep the newest operations that fit in half the limit
+  size_t keep = journal_ops.size();
+  while (keep > 0 && journal.size()-journal_ops[keep-1].begin <= journal_limit/2) {
+    --keep;
+  }
+  size_t first_kept = (keep < journal_ops.size()) ? journal_ops[keep].begin : journal.size();
+  journal.erase(journal.begin(), journal.begin()+first_kept);
+  journal_ops.erase(journal_ops.begin(), journal_ops.begin()+keep);
+  for (size_t i=0; i<journal_ops.size(); ++i) {
+    journal_ops[i].begin -= first_kept;
+  }
+  journal_pos = journal_ops.size();
+}
+
+/*!
+  undo() reverses the last operation in the journal, and redo() repeats
+  the last one undone.  Both return false if there's nothing to do.
+  changes() lists the cells they changed, with their new states.
+*/
+bool Minefield::undo() {
+  change_list.clear();
+  if (journal_pos == 0) return false;
+
+  ownBuffers();
+  --journal_pos;
+  const mf_journal_op_t &op = journal_ops[journal_pos];
+  size_t end = (journal_pos+1 < journal_ops.size()) ? journal_ops[journal_pos+1].begin : journal.size();
+  for (size_t i=end; i>op.begin; --i) {
+    const mf_journal_entry_t &entry = journal[i-1];
+    field[entry.slot] = entry.before;
+    recordCell(entry.slot);
+  }
+  num_cleared -= op.cleared;
+  fake_marks -= op.fake;
+  real_marks -= op.real;
+  return true;
+}
+
+bool Minefield::redo() {
+  change_list.clear();
+  if (journal_pos == journal_ops.size()) return false;
+
+  ownBuffers();
+  const mf_journal_op_t &op = journal_ops[journal_pos];
+  size_t end = (journal_pos+1 < journal_ops.size()) ? journal_ops[journal_pos+1].begin : journal.size();
+  for (size_t i=op.begin; i<end; ++i) {
+    const mf_journal_entry_t &entry = journal[i];
+    field[entry.slot] = entry.after;
+    recordCell(entry.slot);
+  }
+  num_cleared += op.cleared;
+  fake_marks += op.fake;
+  real_marks += op.real;
+  ++journal_pos;
+  return true;
+}
+
+/*!
+  Adds a cell, given by its slot, to changes() with its current state,
+  and marks its row for runs().
+*/
+void Minefield::recordCell(const size_t s) {
+  if (!record_changes && runs_stale) return;
+
+  size_t x, y, z;
+  withLayout([&](const auto &l) { l.position(s, x, y, z); });
+  rowChanged(cellIndex(x,y,z));
+  if (!record_changes) return;
+
+  mf_change_t change = {cellIndex(x,y,z), mf_state_t(field[s])};
+  change_list.push_back(change);
+}
+
+/*!
+  setConcurrent() turns concurrent mode on or off.  While it's on,
+  touch(), mark(), getState(), bombsNear(), hasWon() and minesRemaining()
+  can be called from any number of threads at once, for co-op games and
+  parallel agents.  Every cell changes state with a compare-and-swap, so
+  a cell is only ever opened or marked by one thread, and the counters
+  are updated atomically, so their totals are exact.
+
+  touchMany(), markMany() and chord() throw in concurrent mode.
+  changes() isn't kept in concurrent mode, the journal is turned off, and
+  touch() always uses the flood fill, on one thread per call.  The mode
+  itself must only be changed while no other thread is using the board,
+  as must anything not listed above.  A board in concurrent mode never
+  shares field with a fork, so touch() and mark() don't have to check;
+  near_bombs may be shared, as neither changes it.
+*/
+void Minefield::setConcurrent(const bool on) {
+  concurrent = on;
+  change_list.clear();
+  if (on) {
+    setJournal(0);
+    ownBuffers();
+  }
+}
+
+/*!
+  touch() in concurrent mode.  Each cell is claimed with a compare-and-
+  swap before it's queued, so when flood fills from several threads meet,
+  each cell is opened, expanded and counted by just one of them; between
+  them they open what one flood fill would.  The queue is per thread.
+*/
+size_t Minefield::touchConcurrent(const size_t x, const size_t y, const size_t z) {
+  size_t start = slot(x,y,z);
+  if (!claimCell(field[start])) return 0;
+
+  static thread_local std::vector<size_t> queue;
+  queue.clear();
+  queue.push_back(start);
+  withLayout([&](const auto &l) {
+      for (size_t head=0; head<queue.size(); ++head) {
+	size_t s = queue[head];
+	if (near_bombs[s] != 0) continue;
+
+	l.forEachNeighbor(s, [&](size_t n) {
+	    if (claimCell(field[n])) {
+	      queue.push_back(n);
+	    }
+	  });
+      }
+
+      if (!runs_stale) {
+	for (size_t i=0; i<queue.size(); ++i) {
+	  size_t x, y, z;
+	  l.position(queue[i], x, y, z);
+	  rowChanged(cellIndex(x,y,z));
+	}
+      }
+    });
+
+  __atomic_add_fetch(&num_cleared, queue.size(), __ATOMIC_RELAXED);
+  return queue.size();
+}
+
+/*!
+  mark() in concurrent mode: the cell's new state depends on its old one,
+  so it's retried until the compare-and-swap succeeds.
+*/
+void Minefield::markConcurrent(const size_t x, const size_t y, const size_t z) {
+  mf_cell_t &cell = field[slot(x,y,z)];
+  mf_cell_t before = __atomic_load_n(&cell, __ATOMIC_RELAXED);
+  for (;;) {
+    mf_mark_change_t change = markChange(before);
+    mf_cell_t after = change.after;
+    if (after == before) return;
+
+    if (__atomic_compare_exchange_n(&cell, &before, after, false,
+				    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      // Exactly one of the counters changes, by one either way
+      size_t *counter = (change.fake != 0) ? &fake_marks : &real_marks;
+      if (change.fake+change.real > 0) {
+	__atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+      } else {
+	__atomic_sub_fetch(counter, 1, __ATOMIC_RELAXED);
+      }
+      if (after == marked_empty && !region_start.empty()) {
+	taintRegions(size_t(&cell-field));
+      }
+      rowChanged(cellIndex(x,y,z));
+      return;
+    }
+  }
+}
@@ -23,18 +23,170 @@
 #define MINEFIELD_H
 
 #include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#include "celllayout.h"
+#include "neighborhood.h"
 
 // Possible states that a cell can be in
 enum mf_state_t {open, closed, closed_bomb, marked_empty, marked_bomb};
 
+// Cells are stored one byte each; the value is always an mf_state_t
+typedef unsigned char mf_cell_t;
+
+// A cell that changed state, and the state it changed to.
+// index is the cell's linear index, x + width*(y + height*z).
+struct mf_change_t {
+  size_t index;
+  mf_state_t state;
+};
+
+// A cell changed by an operation in Minefield's journal, by slot
+struct mf_journal_entry_t {
+  size_t slot;
+  mf_cell_t before;
+  mf_cell_t after;
+};
+
+// An operation in the journal: where its cells start in the journal,
+// and what it did to the counters
+struct mf_journal_op_t {
+  size_t begin;
+  ptrdiff_t cleared;
+  ptrdiff_t fake;
+  ptrdiff_t real;
+};
+
+// What a cell looks like to the player: closed, marked, open with a
+// number on it, or open with no bombs near it
+enum mf_view_t {closed_view, marked_view, numbered_view, cleared_view};
+
+// Sets of views, for choosing which runs Minefield::runs() visits
+const unsigned CLOSED_RUNS = 1u << closed_view;
+const unsigned MARKED_RUNS = 1u << marked_view;
+const unsigned NUMBERED_RUNS = 1u << numbered_view;
+const unsigned CLEARED_RUNS = 1u << cleared_view;
+const unsigned VISIBLE_RUNS = CLOSED_RUNS | MARKED_RUNS | NUMBERED_RUNS;
+const unsigned ALL_RUNS = VISIBLE_RUNS | CLEARED_RUNS;
+
+// A run of cells that all look the same: length cells along x,
+// starting at (x,y,z)
+struct mf_run_t {
+  size_t x;
+  size_t y;
+  size_t z;
+  size_t length;
+  mf_view_t view;
+};
+
+// A run as Minefield's row summaries store it, within its row
+struct mf_row_run_t {
+  size_t x;
+  size_t length;
+  mf_view_t view;
+};
+
+/*!
+  MinefieldRunIterator steps through the runs Minefield::runs() visits,
+  row by row in order of z and then y.  Each row's summary says which
+  views it has, so a row without any the caller wants, such as a row
+  that's been cleared, is skipped without looking at its runs.
+*/
+class MinefieldRunIterator {
+ public:
+  MinefieldRunIterator(const mf_row_run_t *runs, const size_t *row_first,
+		       const size_t *row_last, const unsigned char *row_views,
+		       const size_t rows, const size_t height, const unsigned views,
+		       const size_t row)
+    : run_list(runs), first_run(row_first), last_run(row_last), row_view(row_views),
+      num_rows(rows), hght(height), wanted(views), cur_row(row), index(row_first[row]),
+      current() {
+    find();
+  }
+
+  const mf_run_t &operator*() const { return current; }
+  const mf_run_t *operator->() const { return &current; }
+
+  MinefieldRunIterator &operator++() {
+    ++index;
+    find();
+    return *this;
+  }
+
+  bool operator==(const MinefieldRunIterator &other) const { return index == other.index; }
+  bool operator!=(const MinefieldRunIterator &other) const { return index != other.index; }
+
+ private:
+  // Moves on to the first wanted run at or after index
+  void find() {
+    for (; cur_row < num_rows; index = first_run[++cur_row]) {
+      if (!(row_view[cur_row] & wanted)) continue;
+      for (; index < last_run[cur_row]; ++index) {
+	const mf_row_run_t &run = run_list[index];
+	if (wanted & (1u << run.view)) {
+	  current.x = run.x;
+	  current.y = cur_row % hght;
+	  current.z = cur_row / hght;
+	  current.length = run.length;
+	  current.view = run.view;
+	  return;
+	}
+      }
+    }
+  }
+
+  const mf_row_run_t *run_list;
+  const size_t *first_run;
+  const size_t *last_run;
+  const unsigned char *row_view;
+  size_t num_rows;
+  size_t hght;
+  unsigned wanted;
+  size_t cur_row;
+  size_t index;
+  mf_run_t current;
+};
+
+// The runs of one call to Minefield::runs(), for range based for loops
+class MinefieldRuns {
+ public:
+  typedef MinefieldRunIterator iterator;
+
+  MinefieldRuns(const iterator &b, const iterator &e) : first(b), last(e) {}
+
+  iterator begin() const { return first; }
+  iterator end() const { return last; }
+
+ private:
+  iterator first;
+  iterator last;
+};
+
+class MinefieldPool;
 
 class Minefield {
  public:
   
-  Minefield(const size_t w=10, const size_t h=10, const size_t d=10, const int n=50);
+  Minefield(const size_t w=10, const size_t h=10, const size_t d=10, const int n=50,
+	    const uint64_t seed=0, const mf_layout_t layout=row_major_layout,
+	    MinefieldPool *pool=0);
 
   ~Minefield();
 
+  // Boards can be moved, but only copied with fork()
+  Minefield(Minefield &&other);
+  Minefield &operator=(Minefield &&other);
+
+  // Returns a copy of the board that shares its arrays until either of
+  // them changes, for trying moves out.  The first change copies the
+  // whole field, one byte a cell, for that board.
+  Minefield fork() const;
+
+  // Starts a new game, reusing the board's memory where it can
+  void reset(const size_t w, const size_t h, const size_t d, const int n,
+	     const uint64_t seed, const mf_layout_t layout=row_major_layout);
+
   // touch is called when a cell is clicked on.
   size_t touch(const size_t x, const size_t y, const size_t z);
 
@@ -46,25 +198,213 @@ class Minefield {
   size_t height() const { return hght; }
   size_t depth() const { return dpth; }
 
+  // The seed the mines were placed with
+  uint64_t seed() const { return rng_seed; }
+
+  // How the cells are laid out in memory
+  mf_layout_t layout() const { return cell_layout; }
+
+  // Chooses which cells are neighbors and whether the board wraps
+  // around, now and after reset().  The default is the original 26
+  // neighbors on a bounded board.
+  void setNeighborhood(const mf_stencil_t stencil, const mf_topology_t topology);
+  mf_stencil_t stencil() const { return cell_stencil; }
+  mf_topology_t topology() const { return cell_topology; }
+
   // Returns true when the user has marked all bombs or cleared all empty cells
   bool hasWon();
 
   // Marks a cell as being a bomb
   void mark(const size_t x, const size_t y, const size_t z);
 
+  // Batched touch() and mark() on linear cell indices.  changes() lists
+  // everything the whole batch changed.  Both throw in concurrent mode.
+  size_t touchMany(const std::vector<size_t> &cells);
+  void markMany(const std::vector<size_t> &cells);
+
+  // Opens the unmarked neighbors of an open cell whose marked neighbors
+  // match its count.  *hit_bomb is set if one of them is a bomb.  Throws
+  // in concurrent mode.
+  size_t chord(const size_t x, const size_t y, const size_t z, bool *hit_bomb=0);
+
   // Returns the number of bombs near a cell
   size_t bombsNear(const size_t x, const size_t y, const size_t z);
 
   // Returns the number of unmarked bombs
   int minesRemaining();
+
+  // Returns the number of bombs on the board
+  int totalMines() const { return num_bombs; }
+
+  // Converts between cell positions and linear indices
+  size_t cellIndex(const size_t x, const size_t y, const size_t z) const {
+    return (wdth*hght*z)+wdth*y+x;
+  }
+  void cellPosition(const size_t index, size_t &x, size_t &y, size_t &z) const {
+    x = index % wdth;
+    y = (index / wdth) % hght;
+    z = index / (wdth*hght);
+  }
+
+  // Writes the linear indices of a cell's neighbors, in the neighborhood
+  // in use, to out, which needs room for 26.  Returns how many there are.
+  size_t neighborIndices(const size_t index, size_t *out) const;
+
+  // The cells changed by the last touch() or mark(), in the order they
+  // changed.  The buffer is reused, so copy anything you want to keep.
+  const std::vector<mf_change_t> &changes() const { return change_list; }
+
+  // The runs of cells with the given views (a set of *_RUNS), in order
+  // of z, y and x.  It's only valid until the board next changes.
+  MinefieldRuns runs(const unsigned views=VISIBLE_RUNS);
+
+  // Turns recording of changes() on or off.  It's on by default; huge
+  // automated games can turn it off to save the memory.
+  void setRecordChanges(bool record) { record_changes = record; change_list.clear(); }
+
+  // Lets several threads touch() and mark() at once; see minefield.cpp
+  // for what else is safe
+  void setConcurrent(const bool on);
+
+  // Number of cells opened so far
+  size_t cellsOpened() const { return __atomic_load_n(&num_cleared, __ATOMIC_RELAXED); }
+
+  // Turns the precomputed openings that touch() uses on or off, now and
+  // after reset().  They're on by default, except for huge boards.
+  void setRegionLabels(const bool on);
+
+  // Keeps a journal of up to limit cell changes so operations can be
+  // undone and redone; 0 (the default) turns it off.  Throws in
+  // concurrent mode.
+  void setJournal(const size_t limit);
+
+  // Step back and forward through the journal.  They return false if
+  // there's nothing to undo or redo.
+  bool undo();
+  bool redo();
+  bool canUndo() const { return journal_pos > 0; }
+  bool canRedo() const { return journal_pos < journal_ops.size(); }
   
  protected:
   // Used internally to get/set states
-  mf_state_t &state(const size_t x, const size_t y, const size_t z);
+  mf_cell_t &state(const size_t x, const size_t y, const size_t z);
+
+  // Position of cell (x,y,z) in the field and near_bombs arrays
+  size_t slot(const size_t x, const size_t y, const size_t z) const;
+
+  // Calls f(layout) with the layout in use, wrapped in the topology
+  // and stencil in use
+  template <class F>
+  decltype(auto) withLayout(F f) const;
+  template <class L, class F>
+  decltype(auto) withNeighborhood(const L &l, F f) const;
+
+  // Place the mines, serially with Floyd's algorithm or in parallel
+  template <class L>
+  void placeMines(const L &l);
+  template <class L>
+  void placeMinesParallel(const L &l);
+
+  // Builds the near_bombs table after the mines are placed
+  void countNeighbors();
+  template <class L>
+  void countStencil(const L &l);
+
+  // Fills in torus_edges
+  void findTorusEdges();
+
+  // Points field and near_bombs at new buffers with room for at least
+  // slots slots each, or returns one such buffer and its real size
+  void allocateBuffers(const size_t slots);
+  mf_cell_t *allocateBuffer(const size_t slots, size_t &capacity);
+
+  // Drops this board's references to field and near_bombs, or to the
+  // buffer cells, freeing each or giving it back to the pool if it was
+  // the last
+  void releaseBuffers();
+  void dropBuffer(mf_cell_t *cells, const size_t capacity);
+
+  // Whether a fork shares field or near_bombs, and making sure none
+  // shares field, or near_bombs, before it's changed
+  bool sharesBuffers() const;
+  void ownBuffers();
+  void ownCounts();
+
+  // Gives everything back to the pool, or frees it, as if deleted
+  void releaseStorage();
+
+  // Takes everything other has, leaving it an empty 0x0x0 board
+  void moveFrom(Minefield &other);
+
+  // Finds the openings for setRegionLabels()
+  template <class L>
+  void labelRegions(const L &l);
+
+  // Forgets the openings
+  void clearRegions();
+
+  // touch() and mark() in concurrent mode
+  size_t touchConcurrent(const size_t x, const size_t y, const size_t z);
+  void markConcurrent(const size_t x, const size_t y, const size_t z);
+
+  // Stops using the lists of the openings a marked cell is in
+  void taintRegions(const size_t s);
+
+  // touch()'s flood fill, serially and on all cores
+  template <class L>
+  size_t cascade(const L &l, const size_t start);
+  template <class L>
+  void cascadeParallel(const L &l, size_t head);
+
+  // Builds the row summaries for runs(), for every row or just the
+  // rows changed since, and appends one row's runs to run_list
+  void summarizeRows();
+  void summarizeChangedRows();
+  template <class L>
+  void summarizeRow(const L &l, const size_t y, const size_t z, unsigned char *views);
+
+  // Notes that the row of a cell, by linear index, needs summarizing
+  // again
+  void rowChanged(const size_t index);
+
+  // Adds the cells in touch_queue to changes()
+  void recordOpened();
+
+  // Throws unless every linear index is on the board
+  void checkIndices(const std::vector<size_t> &cells) const;
+
+  // Marks or unmarks a cell, recording the change
+  void toggleMark(const size_t index);
+
+  // Adds a cell to changes() with its current state
+  void recordCell(const size_t s);
+
+  // Group the journal's entries into operations
+  void startJournalOp();
+  void endJournalOp();
   
  private:
-  // The array of cells
-  mf_state_t *field;
+  // fork() does the copying; other copies aren't allowed
+  Minefield(const Minefield &parent);
+  Minefield &operator=(const Minefield &) = delete;
+
+  // The array of cells, arranged by the layout (see celllayout.h).  It
+  // has a border at least one cell thick all the way around, so every
+  // cell has 26 neighbors and loops over neighbors don't need bounds
+  // checks.  Border cells hold BORDER_CELL, which is never closed, so
+  // they're never opened.
+  mf_cell_t *field;
+
+  // Number of bombs in the 3x3x3 block around each cell, laid out like field
+  unsigned char *near_bombs;
+
+  // Slots field and near_bombs have room for, and where they came from.
+  // Each is a separate buffer, shared with any forks until one of them
+  // changes it; near_bombs only changes with the mines or the
+  // neighborhood, so forks that just play keep sharing it.
+  size_t field_capacity;
+  size_t count_capacity;
+  MinefieldPool *buffer_pool;
 
   
   size_t wdth;
@@ -72,12 +412,81 @@ class Minefield {
   size_t dpth;
   int num_bombs;
 
+  // Which layout the arrays use, and the layouts themselves.  padded
+  // is always set up; bricked only when it's in use.
+  mf_layout_t cell_layout;
+  PaddedLayout padded;
+  BrickedLayout bricked;
+
+  // Which cells are neighbors, whether the board wraps around, and on a
+  // torus, which slots are on a face of the board (see TorusTopology)
+  mf_stencil_t cell_stencil;
+  mf_topology_t cell_topology;
+  std::vector<unsigned char> torus_edges;
+
+  // The size of a cubic board that has a FixedPaddedLayout, or 0
+  size_t fixed_size;
+
+  // Size of the field and near_bombs arrays
+  size_t total_slots;
+
   // These are used to keep track of game status to determine winning/losing
   size_t num_cleared;
   size_t total_cells;
   size_t num_marked;
   size_t fake_marks;
   size_t real_marks;
+
+  // Seed for the mine placement
+  uint64_t rng_seed;
+
+  // The openings: each empty cell's region, the cells each region opens
+  // (region r's are region_cells[region_start[r]...region_start[r+1]]),
+  // and which regions have to use the flood fill instead.  All empty if
+  // the board isn't labelled.
+  std::vector<uint32_t> region_label;
+  std::vector<uint32_t> region_start;
+  std::vector<uint32_t> region_cells;
+  std::vector<unsigned char> region_tainted;
+  bool label_regions;
+
+  // Whether setConcurrent() is on
+  bool concurrent;
+
+  // Scratch queue for touch()'s flood fill, reused between calls.
+  // Afterwards it holds the cells the last operation opened.
+  std::vector<size_t> touch_queue;
+
+  // Per-thread lists of cells opened by cascadeParallel()
+  std::vector<std::vector<size_t> > cascade_next;
+
+  // Cells changed by the last operation, if record_changes is set
+  std::vector<mf_change_t> change_list;
+  bool record_changes;
+
+  // Row summaries for runs(): the runs of each row (row r's are
+  // run_list[row_first[r]...row_last[r]]), rows numbered y + height*z,
+  // and the set of views in each row.  They're built on the first call
+  // to runs(), and after that only the rows marked in row_changed are
+  // summarized again, their new runs appended to run_list; old_runs
+  // counts the runs left behind, and once they're half of run_list it's
+  // built afresh.  runs_stale means there are no summaries.
+  std::vector<mf_row_run_t> run_list;
+  std::vector<size_t> row_first;
+  std::vector<size_t> row_last;
+  std::vector<unsigned char> row_views;
+  std::vector<unsigned char> row_changed;
+  size_t old_runs;
+  bool runs_stale;
+
+  // Cell changes for undo() and redo(), oldest first, and the operations
+  // they belong to.  journal_pos operations have been applied; the rest
+  // have been undone.  The journal is off when journal_limit is 0.
+  size_t journal_limit;
+  std::vector<mf_journal_entry_t> journal;
+  std::vector<mf_journal_op_t> journal_ops;
+  size_t journal_pos;
+  bool journal_op_started;
 };
 
 
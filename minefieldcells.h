@@ -0,0 +1,124 @@
+/*
+  minefieldcells.h
+
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MINEFIELDCELLS_H
+#define MINEFIELDCELLS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <stdint.h>
+
+#include "minefield.h"
+#include "rng.h"
+
+/*
+  The cell-level steps of the game that Minefield, FixedMinefield and
+  ChunkedMinefield share, so each board plays by exactly the same rules.
+  The loops are templates over the cell layout (see celllayout.h), like
+  Minefield's own.
+*/
+
+// What marking or unmarking a cell does: its new state, and the change
+// to the number of marks on empty cells (fake) and on bombs (real)
+struct mf_mark_change_t {
+  mf_cell_t after;
+  int fake;
+  int real;
+};
+
+/*!
+  markChange() is mark()'s state transition.  Closed cells become marked
+  and marked cells become closed again; an open cell can't be marked, so
+  it comes back unchanged.
+*/
+inline mf_mark_change_t markChange(const mf_cell_t before) {
+  switch (mf_state_t(before)) {
+  case closed:
+    return mf_mark_change_t{marked_empty, 1, 0};
+  case closed_bomb:
+    return mf_mark_change_t{marked_bomb, 0, 1};
+  case marked_empty:
+    return mf_mark_change_t{closed, -1, 0};
+  case marked_bomb:
+    return mf_mark_change_t{closed_bomb, 0, -1};
+  default:
+    return mf_mark_change_t{before, 0, 0};
+  }
+}
+
+/*!
+  placeMinesFloyd() sets every slot of field to border, closes the w*h*d
+  cells of the board and places n mines among them.  Floyd's algorithm
+  picks n distinct cells with exactly n random draws, so it never
+  retries, however dense the board.  The draws depend only on the size,
+  n and the seed, so every layout gets the same board.
+*/
+template <class L>
+void placeMinesFloyd(const L &l, mf_cell_t *field, const size_t slots, const mf_cell_t border,
+		     const size_t w, const size_t h, const size_t d,
+		     const size_t n, const uint64_t seed) {
+  std::fill(field, field+slots, border);
+  for (size_t k=0; k<d; ++k) {
+    for (size_t j=0; j<h; ++j) {
+      for (size_t i=0; i<w; ++i) {
+	field[l.slot(i,j,k)] = closed;
+      }
+    }
+  }
+
+  size_t cells = w*h*d;
+  Xoshiro256 rng(seed);
+  for (size_t j=cells-n; j<cells; ++j) {
+    size_t i = rng.below(j+1);
+    if (field[l.slot(i%w, i/w%h, i/(w*h))] == closed_bomb) {
+      i = j;
+    }
+    field[l.slot(i%w, i/w%h, i/(w*h))] = closed_bomb;
+  }
+}
+
+/*!
+  floodOpen() is touch()'s flood fill.  queue holds slots that are
+  already open; working through it from head, each empty cell opens its
+  closed neighbors and queues them.  It stops when the queue runs out or
+  head reaches stop, and returns where it stopped, so a caller can hand
+  the rest of a big opening to another loop.  Q needs size(),
+  operator[] and push_back(), as std::vector has.
+*/
+template <class L, class Q>
+size_t floodOpen(const L &l, mf_cell_t *field, const unsigned char *near_bombs,
+		 Q &queue, size_t head, const size_t stop) {
+  for (; head < queue.size() && head < stop; ++head) {
+    // Only empty cells spread to their neighbors
+    size_t s = queue[head];
+    if (near_bombs[s] != 0) continue;
+
+    l.forEachNeighbor(s, [&](size_t n) {
+	if (field[n] == closed) {
+	  field[n] = open;
+	  queue.push_back(n);
+	}
+      });
+  }
+  return head;
+}
+
+#endif
@@ -0,0 +1,724 @@
+/*
+  minefieldestimator.cpp
+
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "minefieldestimator.h"
+#include "parallel.h"
+
+const size_t MinefieldEstimator::BATCHES;
+const double MinefieldEstimator::T_95 = 2.365;
+
+// Steps the search may take on a component before it's sampled instead
+static const size_t EXACT_STEPS = size_t(1) << 16;
+
+// Default time budget, in seconds
+static const double DEFAULT_BUDGET = 0.1;
+
+// Classes redrawn together are BLOCK << i for a random i < BLOCK_SIZES,
+// and the steps the enumeration of a block or the search for a chain's
+// first solution may take
+static const size_t BLOCK = 8;
+static const size_t BLOCK_SIZES = 4;
+static const size_t BLOCK_STEPS = size_t(1) << 12;
+static const size_t START_STEPS = size_t(1) << 16;
+
+// The search for a first solution moves a random class, rather than the
+// best, one time in NOISE_ODDS
+static const uint64_t NOISE_ODDS = 5;
+static const size_t NOT_WRONG = ~size_t(0);
+
+// Updates between a chain's samples, at most, and in each chain's first
+// round
+static const size_t MAX_SWEEP = 256;
+static const size_t FIRST_ROUND = 16;
+
+/*!
+  What an update needs that isn't shared: the block, the local number of
+  each constraint it touches, and the ways of filling it found so far,
+  a value for each class of the block.  Each thread has its own.
+*/
+struct BlockScratch {
+  std::vector<uint32_t> block;
+  std::vector<unsigned char> in_block;
+  std::vector<size_t> constraint_slot;
+  std::vector<uint32_t> touched;
+  std::vector<int> need;
+  std::vector<int> left;
+  std::vector<int> remaining;
+  std::vector<uint32_t> values;
+  std::vector<double> leaf_weight;
+  std::vector<uint32_t> leaf_values;
+  size_t steps;
+};
+
+/*!
+  ComponentChain runs the Markov chains of one component.  It keeps the
+  constraints each class is in, and log C(s, j) for each class size s
+  and number of mines j.
+*/
+class ComponentChain {
+ public:
+  ComponentChain(const mf_component_t &comp, const double log_odds);
+
+  // Sets the chain to a solution found by a randomized search.  Returns
+  // false if none was found within START_STEPS, leaving the search's
+  // state in the chain for the next call to carry on from.
+  bool start(Xoshiro256 &rng, mf_chain_t &chain) const;
+
+  // Redraws a block of classes.  Solutions are weighted by log_weight of
+  // their number of mines if it's given, and by odds^mines if not.
+  void update(Xoshiro256 &rng, mf_chain_t &chain, BlockScratch &scratch,
+	      const std::vector<double> *log_weight) const;
+
+  // Updates between samples
+  size_t sweep() const { return std::min(comp->class_size.size()/BLOCK + 1, MAX_SWEEP); }
+
+ private:
+  // Enumerates the ways of filling the block from its i-th class on
+  void fill(BlockScratch &scratch, const size_t i, const size_t mines, const double weight,
+	    const size_t outside, const std::vector<double> *log_weight) const;
+
+  const mf_component_t *comp;
+  std::vector<size_t> class_start;
+  std::vector<uint32_t> class_constraints;
+  std::vector<int> constraint_cells;
+  std::vector<std::vector<double> > log_binomial;
+  double log_odds;
+};
+
+ComponentChain::ComponentChain(const mf_component_t &c, const double odds) : comp(&c), log_odds(odds) {
+  size_t num_classes = comp->class_size.size();
+  size_t num_constraints = comp->mines_needed.size();
+  class_start.assign(num_classes+1, 0);
+  for (size_t i=0; i<comp->constraint_classes.size(); ++i) {
+    ++class_start[comp->constraint_classes[i]+1];
+  }
+  for (size_t i=0; i<num_classes; ++i) {
+    class_start[i+1] += class_start[i];
+  }
+  class_constraints.resize(comp->constraint_classes.size());
+  std::vector<size_t> next(class_start.begin(), class_start.end()-1);
+  constraint_cells.assign(num_constraints, 0);
+  for (size_t k=0; k<num_constraints; ++k) {
+    for (size_t i=comp->constraint_start[k]; i<comp->constraint_start[k+1]; ++i) {
+      constraint_cells[k] += int(comp->class_size[comp->constraint_classes[i]]);
+      class_constraints[next[comp->constraint_classes[i]]++] = uint32_t(k);
+    }
+  }
+
+  uint32_t biggest = *std::max_element(comp->class_size.begin(), comp->class_size.end());
+  log_binomial.resize(biggest+1);
+  for (size_t s=0; s<=biggest; ++s) {
+    log_binomial[s].resize(s+1);
+    for (size_t j=0; j<=s; ++j) {
+      log_binomial[s][j] = std::lgamma(double(s)+1.0) - std::lgamma(double(j)+1.0)
+	- std::lgamma(double(s-j)+1.0);
+    }
+  }
+}
+
+/*!
+  A local search: every class starts with a number of mines drawn by
+  weight, and then while any constraint has the wrong number, a class
+  in one of them is moved a mine towards it.  The class chosen is the
+  one that leaves the fewest mines wrong over all its constraints, or
+  now and then a random one, so the search can't get stuck going round
+  the same few.  Backtracking, as countSolutions() does, can spend all
+  its time undoing choices that were fine when a component has tens of
+  thousands of classes.  The search is cut into calls of START_STEPS,
+  so the time budget is checked between them.
+*/
+bool ComponentChain::start(Xoshiro256 &rng, mf_chain_t &chain) const {
+  size_t num_classes = comp->class_size.size();
+  size_t num_constraints = comp->mines_needed.size();
+  std::vector<double> weight;
+  if (chain.chosen.size() != num_classes) {
+    chain.chosen.assign(num_classes, 0);
+    for (size_t cls=0; cls<num_classes; ++cls) {
+      int size = int(comp->class_size[cls]);
+      weight.resize(size_t(size+1));
+      double total = 0.0;
+      for (int j=0; j<=size; ++j) {
+	weight[j] = std::exp(log_binomial[size][j] + double(j)*log_odds);
+	total += weight[j];
+      }
+      double u = double(rng.next() >> 11) * (1.0/9007199254740992.0) * total;
+      int value = 0;
+      for (double sum = weight[0]; value < size && sum <= u; sum += weight[++value]) {
+      }
+      chain.chosen[cls] = uint32_t(value);
+    }
+  }
+
+  // How many mines each constraint is over by, and the ones that are
+  // wrong, with each one's place in the list
+  std::vector<int> over(num_constraints);
+  std::vector<uint32_t> wrong;
+  std::vector<size_t> place(num_constraints, NOT_WRONG);
+  auto check = [&](uint32_t c) {
+    if (over[c] != 0 && place[c] == NOT_WRONG) {
+      place[c] = wrong.size();
+      wrong.push_back(c);
+    } else if (over[c] == 0 && place[c] != NOT_WRONG) {
+      place[wrong.back()] = place[c];
+      wrong[place[c]] = wrong.back();
+      wrong.pop_back();
+      place[c] = NOT_WRONG;
+    }
+  };
+  for (uint32_t c=0; c<num_constraints; ++c) {
+    over[c] = -comp->mines_needed[c];
+    for (size_t i=comp->constraint_start[c]; i<comp->constraint_start[c+1]; ++i) {
+      over[c] += int(chain.chosen[comp->constraint_classes[i]]);
+    }
+    check(c);
+  }
+
+  std::vector<uint32_t> candidates;
+  for (size_t steps=0; !wrong.empty(); ++steps) {
+    if (steps > START_STEPS) {
+      return false;
+    }
+    uint32_t c = wrong[rng.below(wrong.size())];
+    int step = (over[c] > 0) ? -1 : 1;
+
+    candidates.clear();
+    int best = std::numeric_limits<int>::max();
+    bool noise = (rng.below(NOISE_ODDS) == 0);
+    for (size_t i=comp->constraint_start[c]; i<comp->constraint_start[c+1]; ++i) {
+      uint32_t cls = comp->constraint_classes[i];
+      int value = int(chain.chosen[cls]) + step;
+      if (value < 0 || value > int(comp->class_size[cls])) continue;
+      int change = 0;
+      for (size_t j=class_start[cls]; j<class_start[cls+1]; ++j) {
+	int o = over[class_constraints[j]];
+	change += std::abs(o + step) - std::abs(o);
+      }
+      if (!noise && change < best) {
+	candidates.clear();
+	best = change;
+      }
+      if (noise || change == best) {
+	candidates.push_back(cls);
+      }
+    }
+    if (candidates.empty()) continue;
+
+    uint32_t cls = candidates[rng.below(candidates.size())];
+    chain.chosen[cls] = uint32_t(int(chain.chosen[cls]) + step);
+    for (size_t j=class_start[cls]; j<class_start[cls+1]; ++j) {
+      over[class_constraints[j]] += step;
+      check(class_constraints[j]);
+    }
+  }
+
+  chain.mines = 0;
+  for (size_t i=0; i<num_classes; ++i) {
+    chain.mines += chain.chosen[i];
+  }
+  chain.started = true;
+  return true;
+}
+
+void ComponentChain::fill(BlockScratch &scratch, const size_t i, const size_t mines,
+			  const double weight, const size_t outside,
+			  const std::vector<double> *log_weight) const {
+  if (++scratch.steps > BLOCK_STEPS) return;
+
+  size_t m = scratch.block.size();
+  if (i == m) {
+    double w = weight;
+    if (log_weight) {
+      w += (*log_weight)[outside + mines];
+    } else {
+      w += double(mines)*log_odds;
+    }
+    scratch.leaf_weight.push_back(w);
+    scratch.leaf_values.insert(scratch.leaf_values.end(), scratch.values.begin(),
+			       scratch.values.begin() + m);
+    return;
+  }
+
+  uint32_t cls = scratch.block[i];
+  int size = int(comp->class_size[cls]);
+  int low = 0, high = size;
+  for (size_t j=class_start[cls]; j<class_start[cls+1]; ++j) {
+    size_t c = scratch.constraint_slot[class_constraints[j]];
+    low = std::max(low, scratch.need[c] - (scratch.left[c] - size));
+    high = std::min(high, scratch.need[c]);
+  }
+  for (int value=low; value<=high; ++value) {
+    for (size_t j=class_start[cls]; j<class_start[cls+1]; ++j) {
+      size_t c = scratch.constraint_slot[class_constraints[j]];
+      scratch.need[c] -= value;
+      scratch.left[c] -= size;
+    }
+    scratch.values[i] = uint32_t(value);
+    fill(scratch, i+1, mines + size_t(value), weight + log_binomial[size][value], outside, log_weight);
+    for (size_t j=class_start[cls]; j<class_start[cls+1]; ++j) {
+      size_t c = scratch.constraint_slot[class_constraints[j]];
+      scratch.need[c] += value;
+      scratch.left[c] += size;
+    }
+  }
+}
+
+/*!
+  The block is grown breadth first from a random class through the
+  constraints it shares, so its classes constrain each other.  Every way
+  of filling it that meets the constraints, given the classes outside
+  it, is enumerated and one is drawn in proportion to its weight, which
+  is a Gibbs update of the block.  The current filling is always among
+  them.  If there are too many to enumerate, the chain stays put, which
+  leaves its distribution as it was, since whether that happens doesn't
+  depend on the block's current values.
+*/
+void ComponentChain::update(Xoshiro256 &rng, mf_chain_t &chain, BlockScratch &scratch,
+			    const std::vector<double> *log_weight) const {
+  size_t num_classes = comp->class_size.size();
+  size_t num_constraints = comp->mines_needed.size();
+  if (scratch.constraint_slot.size() < num_constraints) {
+    scratch.constraint_slot.resize(num_constraints, ~size_t(0));
+  }
+  if (scratch.in_block.size() < num_classes) {
+    scratch.in_block.resize(num_classes, 0);
+  }
+  size_t size = BLOCK << rng.below(BLOCK_SIZES);
+  std::vector<uint32_t> &block = scratch.block;
+  block.assign(1, uint32_t(rng.below(num_classes)));
+  scratch.in_block[block[0]] = 1;
+  scratch.touched.clear();
+  for (size_t head=0; head<block.size(); ++head) {
+    uint32_t cls = block[head];
+    for (size_t j=class_start[cls]; j<class_start[cls+1]; ++j) {
+      uint32_t c = class_constraints[j];
+      if (scratch.constraint_slot[c] != ~size_t(0)) continue;
+      scratch.constraint_slot[c] = scratch.touched.size();
+      scratch.touched.push_back(c);
+      for (size_t i=comp->constraint_start[c]; i<comp->constraint_start[c+1] && block.size() < size; ++i) {
+	uint32_t other = comp->constraint_classes[i];
+	if (!scratch.in_block[other]) {
+	  scratch.in_block[other] = 1;
+	  block.push_back(other);
+	}
+      }
+    }
+  }
+
+  size_t m = block.size();
+  scratch.need.resize(scratch.touched.size());
+  scratch.left.resize(scratch.touched.size());
+  for (size_t t=0; t<scratch.touched.size(); ++t) {
+    uint32_t c = scratch.touched[t];
+    int need = comp->mines_needed[c], left = 0;
+    for (size_t i=comp->constraint_start[c]; i<comp->constraint_start[c+1]; ++i) {
+      uint32_t cls = comp->constraint_classes[i];
+      if (!scratch.in_block[cls]) {
+	need -= int(chain.chosen[cls]);
+      } else {
+	left += int(comp->class_size[cls]);
+      }
+    }
+    scratch.need[t] = need;
+    scratch.left[t] = left;
+  }
+
+  // Order the block so each constraint is closed off as soon as can be:
+  // next is the class in the constraint with the fewest classes left
+  std::vector<int> &remaining = scratch.remaining;
+  remaining.assign(scratch.touched.size(), 0);
+  for (size_t i=0; i<m; ++i) {
+    for (size_t j=class_start[block[i]]; j<class_start[block[i]+1]; ++j) {
+      ++remaining[scratch.constraint_slot[class_constraints[j]]];
+    }
+  }
+  for (size_t i=0; i<m; ++i) {
+    size_t best = i;
+    int fewest = std::numeric_limits<int>::max();
+    for (size_t b=i; b<m; ++b) {
+      for (size_t j=class_start[block[b]]; j<class_start[block[b]+1]; ++j) {
+	int r = remaining[scratch.constraint_slot[class_constraints[j]]];
+	if (r < fewest) {
+	  fewest = r;
+	  best = b;
+	}
+      }
+    }
+    std::swap(block[i], block[best]);
+    for (size_t j=class_start[block[i]]; j<class_start[block[i]+1]; ++j) {
+      --remaining[scratch.constraint_slot[class_constraints[j]]];
+    }
+  }
+
+  size_t inside = 0;
+  for (size_t i=0; i<m; ++i) {
+    inside += chain.chosen[block[i]];
+  }
+  scratch.values.resize(m);
+  scratch.leaf_weight.clear();
+  scratch.leaf_values.clear();
+  scratch.steps = 0;
+  fill(scratch, 0, 0, 0.0, chain.mines - inside, log_weight);
+  for (size_t t=0; t<scratch.touched.size(); ++t) {
+    scratch.constraint_slot[scratch.touched[t]] = ~size_t(0);
+  }
+  for (size_t i=0; i<m; ++i) {
+    scratch.in_block[block[i]] = 0;
+  }
+  if (scratch.steps > BLOCK_STEPS || scratch.leaf_weight.empty()) return;
+
+  double top = *std::max_element(scratch.leaf_weight.begin(), scratch.leaf_weight.end());
+  if (!(top > -std::numeric_limits<double>::infinity())) return;
+  double total = 0.0;
+  for (size_t l=0; l<scratch.leaf_weight.size(); ++l) {
+    scratch.leaf_weight[l] = std::exp(scratch.leaf_weight[l] - top);
+    total += scratch.leaf_weight[l];
+  }
+  double u = double(rng.next() >> 11) * (1.0/9007199254740992.0) * total;
+  size_t leaf = 0;
+  for (double sum = scratch.leaf_weight[0]; leaf+1 < scratch.leaf_weight.size() && sum <= u;
+       sum += scratch.leaf_weight[++leaf]) {
+  }
+
+  chain.mines -= inside;
+  for (size_t i=0; i<m; ++i) {
+    chain.chosen[block[i]] = scratch.leaf_values[leaf*m + i];
+    chain.mines += chain.chosen[block[i]];
+  }
+}
+
+MinefieldEstimator::MinefieldEstimator(MinefieldSolver &s) : MinefieldProbability(s),
+							      budget(DEFAULT_BUDGET), rng_seed(1),
+							      num_samples(0), num_started(0), log_odds(0.0),
+							      interior_margin(0.0) {
+  setLimit(EXACT_STEPS);
+}
+
+// Half the width of the 95% interval for the mean of values
+static double spread(const std::vector<double> &values, const double t) {
+  size_t n = values.size();
+  double mean = 0.0, square = 0.0;
+  for (size_t i=0; i<n; ++i) {
+    mean += values[i];
+  }
+  mean /= double(n);
+  for (size_t i=0; i<n; ++i) {
+    square += (values[i] - mean)*(values[i] - mean);
+  }
+  return t*std::sqrt(square/double(n-1)/double(n));
+}
+
+/*!
+  The chains are run in rounds of a few updates each, so the budget is
+  checked often; the rounds get bigger while they're quick.  A chain
+  that hasn't found its first solution looks for it at the start of
+  each round, and after a round takes one another chain of the same
+  component found, since on a big component finding one can take longer
+  than the budget; from there its own stream soon takes it somewhere
+  else.  Once a search of a component has given up, only as many of its
+  chains as there are threads carry on searching: more would only take
+  turns on the same threads and put the first solution off.  The
+  time taken counting the components that can be counted comes out of
+  the same budget, but each phase always gets at least one round, and
+  the first goes on past its share while a component has no solution.
+*/
+bool MinefieldEstimator::estimate() {
+  typedef std::chrono::steady_clock clock;
+  clock::time_point start = clock::now();
+  auto elapsed = [&]() { return std::chrono::duration<double>(clock::now() - start).count(); };
+
+  findComponents();
+  bool exact = countComponents();
+  frontier_margin.assign(frontier_cells.size(), 0.0);
+  interior_margin = 0.0;
+  num_samples = 0;
+  num_started = 0;
+  if (exact) {
+    chains.clear();
+    if (combine()) return true;
+    invalidate();
+    return false;
+  }
+
+  std::vector<size_t> sampled;
+  for (size_t c=0; c<comps.size(); ++c) {
+    if (!comps[c].exact) {
+      sampled.push_back(c);
+    }
+  }
+
+  // Weigh solutions at about the rate mines are left at, so the chains
+  // spend their time near the numbers of mines that matter
+  double density = double(mines_left) / double(interior_cells + frontier_cells.size());
+  density = std::min(std::max(density, 0.001), 0.999);
+  log_odds = std::log(density/(1.0 - density));
+  std::vector<ComponentChain> runners;
+  for (size_t i=0; i<sampled.size(); ++i) {
+    runners.push_back(ComponentChain(comps[sampled[i]], log_odds));
+  }
+
+  chains.resize(sampled.size()*BATCHES);
+  streams.clear();
+  Xoshiro256 stream(rng_seed);
+  for (size_t i=0; i<chains.size(); ++i) {
+    const mf_component_t &comp = comps[sampled[i/BATCHES]];
+    mf_chain_t &chain = chains[i];
+    chain.chosen.clear();
+    chain.mines = chain.updates = 0;
+    chain.started = false;
+    chain.samples = chain.weighed_samples = 0;
+    chain.mine_counts.assign(comp.cells.size()+1, 0.0);
+    chain.class_mines.assign(comp.class_size.size(), 0.0);
+    streams.push_back(stream);
+    stream.jump();
+  }
+
+  // Both phases use the same threads, which the scratch is sized for
+  unsigned threads = workerThreads();
+  std::vector<BlockScratch> scratch(threads);
+  // Whether a search for a first solution of each sampled component has
+  // given up
+  std::vector<std::atomic<bool> > gave_up(sampled.size());
+  std::vector<std::vector<double> > log_weights;
+  // Records a chain's current solution
+  auto record = [&](mf_chain_t &chain, const bool weighed) {
+    chain.updates = 0;
+    if (weighed) {
+      ++chain.weighed_samples;
+      for (size_t cls=0; cls<chain.chosen.size(); ++cls) {
+	chain.class_mines[cls] += chain.chosen[cls];
+      }
+    } else {
+      ++chain.samples;
+      ++chain.mine_counts[chain.mines];
+    }
+  };
+  auto run = [&](const double until, const bool weighed) {
+    size_t round = FIRST_ROUND;
+    bool waiting;
+    do {
+      double round_start = elapsed();
+      parallelFor(chains.size(), threads, [&](size_t i, unsigned worker) {
+	  const ComponentChain &runner = runners[i/BATCHES];
+	  mf_chain_t &chain = chains[i];
+	  if (!chain.started) {
+	    std::atomic<bool> &hard = gave_up[i/BATCHES];
+	    if (i%BATCHES >= threads && hard.load(std::memory_order_relaxed)) return;
+	    if (!runner.start(streams[i], chain)) {
+	      hard.store(true, std::memory_order_relaxed);
+	      return;
+	    }
+	  }
+	  for (size_t u=0; u<round; ++u) {
+	    runner.update(streams[i], chain, scratch[worker],
+			  weighed ? &log_weights[sampled[i/BATCHES]] : 0);
+	    if (++chain.updates == runner.sweep()) {
+	      record(chain, weighed);
+	    }
+	  }
+	});
+      if (elapsed() - round_start < budget/16.0) {
+	round *= 2;
+      }
+
+      // Chains that haven't found a solution yet take one another chain
+      // of their component has
+      waiting = false;
+      for (size_t i=0; i<chains.size(); ++i) {
+	mf_chain_t &chain = chains[i];
+	size_t first = i - i%BATCHES;
+	for (size_t j=first; !chain.started && j<first+BATCHES; ++j) {
+	  if (chains[j].started) {
+	    chain.chosen = chains[j].chosen;
+	    chain.mines = chains[j].mines;
+	    chain.started = true;
+	  }
+	}
+	waiting = waiting || !chain.started;
+      }
+    } while (elapsed() < until || (waiting && elapsed() < budget));
+
+    // A chain that hasn't got to the end of a sweep still has a solution
+    for (size_t i=0; i<chains.size(); ++i) {
+      mf_chain_t &chain = chains[i];
+      if (chain.started && (weighed ? chain.weighed_samples : chain.samples) == 0) {
+	record(chain, weighed);
+      }
+    }
+  };
+
+  // First the counts by number of mines, and the interior from each
+  // chain's counts
+  run(budget/3.0, false);
+  for (size_t i=0; i<chains.size(); ++i) {
+    num_started += chains[i].started;
+  }
+  std::vector<double> batch_interior;
+  for (size_t b=0; b<BATCHES; ++b) {
+    if (useCounts(sampled, b) && weigh(log_weights)) {
+      batch_interior.push_back(interior_probability);
+    }
+  }
+  useAllCounts(sampled);
+  if (!weigh(log_weights)) {
+    invalidate();
+    return false;
+  }
+  frontier_probability.assign(frontier_cells.size(), 0.0);
+  for (size_t c=0; c<comps.size(); ++c) {
+    if (comps[c].exact && !applyWeights(comps[c], log_weights[c])) {
+      invalidate();
+      return false;
+    }
+  }
+  interior_margin = (batch_interior.size() < 2) ? 1.0 : spread(batch_interior, T_95);
+
+  // Then the cells
+  run(budget, true);
+  for (size_t i=0; i<chains.size(); ++i) {
+    num_samples += chains[i].samples + chains[i].weighed_samples;
+  }
+  for (size_t i=0; i<sampled.size(); ++i) {
+    if (!useClassMines(comps[sampled[i]], i*BATCHES)) {
+      invalidate();
+      return false;
+    }
+  }
+  return true;
+}
+
+/*!
+  Each chain's average gives an estimate, and the spread of those the
+  margin.  A component none of whose chains took a sample fails.
+*/
+bool MinefieldEstimator::useClassMines(const mf_component_t &comp, const size_t first) {
+  size_t num_classes = comp.class_size.size();
+  std::vector<double> mines(num_classes, 0.0);
+  std::vector<size_t> used;
+  for (size_t b=0; b<BATCHES; ++b) {
+    const mf_chain_t &chain = chains[first+b];
+    if (chain.weighed_samples == 0) continue;
+    used.push_back(first+b);
+    for (size_t cls=0; cls<num_classes; ++cls) {
+      mines[cls] += chain.class_mines[cls] / double(chain.weighed_samples);
+    }
+  }
+  if (used.empty()) {
+    return false;
+  }
+
+  std::vector<double> values(used.size());
+  std::vector<double> class_margin(num_classes, 1.0);
+  for (size_t cls=0; cls<num_classes; ++cls) {
+    mines[cls] /= double(used.size());
+    if (used.size() < 2) continue;
+    for (size_t u=0; u<used.size(); ++u) {
+      const mf_chain_t &chain = chains[used[u]];
+      values[u] = chain.class_mines[cls] / double(chain.weighed_samples) / comp.class_size[cls];
+    }
+    class_margin[cls] = spread(values, T_95);
+  }
+  for (size_t v=0; v<comp.cells.size(); ++v) {
+    uint32_t cls = comp.cell_class[v];
+    size_t slot = frontier_slot[comp.cells[v]];
+    frontier_probability[slot] = mines[cls] / comp.class_size[cls];
+    frontier_margin[slot] = class_margin[cls];
+  }
+  return true;
+}
+
+double MinefieldEstimator::margin(const size_t index) const {
+  if (index >= frontier_slot.size()) {
+    throw std::runtime_error("Invalid index");
+  }
+
+  if (frontier_slot[index] != NO_CELL) {
+    return frontier_margin[frontier_slot[index]];
+  }
+  if (solver.isMine(index) || solver.isSafe(index)) {
+    return 0.0;
+  }
+
+  Minefield &mf = solver.board();
+  size_t x, y, z;
+  mf.cellPosition(index, x, y, z);
+  return (mf.getState(x,y,z) == open) ? 0.0 : interior_margin;
+}
+
+/*!
+  A chain samples a solution with k mines in proportion to its count
+  times odds^k, so the count is the frequency over odds^k.  That's
+  worked out in logs and scaled so the biggest is 1.
+*/
+static void setSolutions(mf_component_t &comp, const std::vector<double> &frequency,
+			 const double log_odds) {
+  size_t n = frequency.size();
+  std::vector<double> log_count(n, -std::numeric_limits<double>::infinity());
+  double top = -std::numeric_limits<double>::infinity();
+  for (size_t k=0; k<n; ++k) {
+    if (frequency[k] > 0.0) {
+      log_count[k] = std::log(frequency[k]) - double(k)*log_odds;
+      top = std::max(top, log_count[k]);
+    }
+  }
+  comp.solutions.assign(n, 0.0);
+  for (size_t k=0; k<n; ++k) {
+    if (frequency[k] > 0.0) {
+      comp.solutions[k] = std::exp(log_count[k] - top);
+    }
+  }
+}
+
+bool MinefieldEstimator::useCounts(const std::vector<size_t> &sampled, const size_t batch) {
+  for (size_t i=0; i<sampled.size(); ++i) {
+    const mf_chain_t &chain = chains[i*BATCHES + batch];
+    if (chain.samples == 0) {
+      return false;
+    }
+    setSolutions(comps[sampled[i]], chain.mine_counts, log_odds);
+  }
+  return true;
+}
+
+/*!
+  Each chain's frequencies are averaged, so chains that took more
+  samples don't count for more.
+*/
+void MinefieldEstimator::useAllCounts(const std::vector<size_t> &sampled) {
+  std::vector<double> frequency;
+  for (size_t i=0; i<sampled.size(); ++i) {
+    frequency.assign(chains[i*BATCHES].mine_counts.size(), 0.0);
+    for (size_t b=0; b<BATCHES; ++b) {
+      const mf_chain_t &chain = chains[i*BATCHES + b];
+      if (chain.samples == 0) continue;
+      for (size_t k=0; k<frequency.size(); ++k) {
+	frequency[k] += chain.mine_counts[k] / double(chain.samples);
+      }
+    }
+    setSolutions(comps[sampled[i]], frequency, log_odds);
+  }
+}
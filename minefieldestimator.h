@@ -0,0 +1,141 @@
+/*
+  minefieldestimator.h
+
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MINEFIELDESTIMATOR_H
+#define MINEFIELDESTIMATOR_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#include "minefieldprobability.h"
+#include "rng.h"
+
+/*!
+  One Markov chain over the solutions of a component, and what it has
+  seen: how often each number of mines came up in the first phase, and
+  the mines in each class summed over the second.
+*/
+struct mf_chain_t {
+  // The current solution: mines in each class, and in all of them, and
+  // the updates made since the last sample
+  std::vector<uint32_t> chosen;
+  size_t mines;
+  size_t updates;
+  bool started;
+
+  size_t samples;
+  std::vector<double> mine_counts;
+
+  size_t weighed_samples;
+  std::vector<double> class_mines;
+};
+
+/*!
+  MinefieldEstimator estimates the probabilities MinefieldProbability
+  works out, for boards whose components are too big to count.
+
+  Components the search can count within its limit are counted, and the
+  rest are sampled by Markov chain Monte Carlo.  A chain starts at a
+  solution found by a randomized search, then repeatedly picks a small
+  connected block of classes and redraws their numbers of mines from
+  all the ways of filling the block that keep every constraint met,
+  each in proportion to its weight.  Every state is a solution, and the
+  chain samples them in proportion to their weight.
+
+  In the first phase a solution with k mines is weighted by the
+  arrangements of its classes times odds^k, the odds of a cell being a
+  mine, and how often each k comes up gives the component's counts by
+  number of mines.  Those are weighed with the exact ones as
+  MinefieldProbability weighs its own.  In the second phase solutions
+  are weighted by those weights instead of odds^k, and each class's
+  average number of mines gives its cells' probability.  The first
+  phase gets a third of the time budget.
+
+  There are BATCHES independent chains for each component, each with
+  its own generator stream, run in rounds spread over all the threads
+  until the time budget runs out.  Each chain also gets its own
+  estimate, and the spread of those gives a 95% confidence interval for
+  each cell.  The interval covers the sampling of the cell's own
+  component, not of the weights.
+*/
+class MinefieldEstimator : public MinefieldProbability {
+ public:
+  // Works from solver, which must outlive it
+  explicit MinefieldEstimator(MinefieldSolver &solver);
+
+  // Estimates the probabilities for the board as the solver sees it
+  // now, taking about as long as the budget.  Returns false if there's
+  // a component no chain could find a solution to.
+  bool estimate();
+
+  // Half the width of the 95% confidence interval for the probability
+  // of a cell, by linear index, as of the last estimate().  It's 0 for
+  // open and proven cells and cells in components that were counted.
+  double margin(const size_t index) const;
+
+  // Sets how long estimate() may take, in seconds
+  void setBudget(const double seconds) { budget = seconds; }
+
+  // Sets the seed the generator streams start from
+  void setSeed(const uint64_t seed) { rng_seed = seed; }
+
+  // Solutions sampled by the last estimate(), over all chains
+  size_t samples() const { return num_samples; }
+
+  // Chains the last estimate() ran, and how many of them found a
+  // solution of their own or from another chain of their component
+  size_t chainsRun() const { return chains.size(); }
+  size_t chainsStarted() const { return num_started; }
+
+ private:
+  // Chains per component, and Student's t for a 95% interval with
+  // BATCHES - 1 degrees of freedom
+  static const size_t BATCHES = 8;
+  static const double T_95;
+
+  // Sets the sampled components' counts from the given chain's first
+  // phase, or from all of them.  Returns false if a chain has no
+  // samples.
+  bool useCounts(const std::vector<size_t> &sampled, const size_t batch);
+  void useAllCounts(const std::vector<size_t> &sampled);
+
+  // Sets the probabilities and margins of a sampled component's cells
+  // from its chains, at chains[first...].  Returns false if none of them
+  // has a sample.
+  bool useClassMines(const mf_component_t &comp, const size_t first);
+
+  double budget;
+  uint64_t rng_seed;
+  size_t num_samples;
+  size_t num_started;
+  double log_odds;
+
+  // Each sampled component's chains and their generator streams, at
+  // [component*BATCHES + batch]
+  std::vector<mf_chain_t> chains;
+  std::vector<Xoshiro256> streams;
+
+  std::vector<double> frontier_margin;
+  double interior_margin;
+};
+
+#endif
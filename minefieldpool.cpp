@@ -0,0 +1,131 @@
+/*
+  minefieldpool.cpp
+ 
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "minefieldpool.h"
+
+/*!
+  The pool starts empty.  The spare lists are given room up front so
+  handing things back doesn't allocate either.
+*/
+MinefieldPool::MinefieldPool() : num_allocations(0) {
+  buffers.reserve(16);
+  size_vectors.reserve(16);
+  label_vectors.reserve(48);
+  byte_vectors.reserve(16);
+  change_vectors.reserve(16);
+}
+
+/*!
+  Frees the spare buffers.  Buffers still held by Minefields aren't the
+  pool's any more.
+*/
+MinefieldPool::~MinefieldPool() {
+  for (size_t i=0; i<buffers.size(); ++i) {
+    delete[] buffers[i].second;
+  }
+}
+
+/*!
+  take() hands out the smallest spare buffer that's big enough, or
+  allocates a new one if none is.
+*/
+unsigned char *MinefieldPool::take(const size_t n, size_t &capacity) {
+  std::lock_guard<std::mutex> guard(lock);
+  size_t best = buffers.size();
+  for (size_t i=0; i<buffers.size(); ++i) {
+    if (buffers[i].first >= n && (best == buffers.size() || buffers[i].first < buffers[best].first)) {
+      best = i;
+    }
+  }
+
+  if (best == buffers.size()) {
+    ++num_allocations;
+    capacity = n;
+    return new unsigned char[n];
+  }
+
+  unsigned char *buffer = buffers[best].second;
+  capacity = buffers[best].first;
+  buffers[best] = buffers.back();
+  buffers.pop_back();
+  return buffer;
+}
+
+void MinefieldPool::give(unsigned char *buffer, const size_t capacity) {
+  if (buffer) {
+    std::lock_guard<std::mutex> guard(lock);
+    buffers.push_back(std::make_pair(capacity, buffer));
+  }
+}
+
+/*!
+  Swaps v for the last spare in spares, if there is one
+*/
+template <class T>
+static void takeSpare(std::vector<std::vector<T> > &spares, std::vector<T> &v) {
+  if (!spares.empty()) {
+    v.swap(spares.back());
+    spares.pop_back();
+  }
+}
+
+/*!
+  Keeps v's storage as a spare, leaving v empty
+*/
+template <class T>
+static void giveSpare(std::vector<std::vector<T> > &spares, std::vector<T> &v) {
+  v.clear();
+  spares.push_back(std::vector<T>());
+  spares.back().swap(v);
+}
+
+void MinefieldPool::takeVector(std::vector<size_t> &v) {
+  std::lock_guard<std::mutex> guard(lock);
+  takeSpare(size_vectors, v);
+}
+void MinefieldPool::takeVector(std::vector<uint32_t> &v) {
+  std::lock_guard<std::mutex> guard(lock);
+  takeSpare(label_vectors, v);
+}
+void MinefieldPool::takeVector(std::vector<unsigned char> &v) {
+  std::lock_guard<std::mutex> guard(lock);
+  takeSpare(byte_vectors, v);
+}
+void MinefieldPool::takeVector(std::vector<mf_change_t> &v) {
+  std::lock_guard<std::mutex> guard(lock);
+  takeSpare(change_vectors, v);
+}
+void MinefieldPool::giveVector(std::vector<size_t> &v) {
+  std::lock_guard<std::mutex> guard(lock);
+  giveSpare(size_vectors, v);
+}
+void MinefieldPool::giveVector(std::vector<uint32_t> &v) {
+  std::lock_guard<std::mutex> guard(lock);
+  giveSpare(label_vectors, v);
+}
+void MinefieldPool::giveVector(std::vector<unsigned char> &v) {
+  std::lock_guard<std::mutex> guard(lock);
+  giveSpare(byte_vectors, v);
+}
+void MinefieldPool::giveVector(std::vector<mf_change_t> &v) {
+  std::lock_guard<std::mutex> guard(lock);
+  giveSpare(change_vectors, v);
+}
@@ -0,0 +1,88 @@
+/*
+  minefieldpool.h
+ 
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MINEFIELDPOOL_H
+#define MINEFIELDPOOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "minefield.h"
+
+/*!
+  MinefieldPool keeps the buffers of Minefields that have been deleted so
+  the next Minefield made with the same pool can have them, instead of
+  going back to the heap.  That's the cell and count arrays, and the
+  scratch vectors for touch(), changes() and the openings, which keep
+  their capacity.
+  Once a pool has seen a board of a given size, more boards of that size
+  don't allocate anything while they're set up or played.
+
+  Forks of a board use its pool, and may be played and deleted on other
+  threads, so the pool takes a lock around each call.  It's never
+  contended by a single thread's boards, so one pool per thread is still
+  the fastest.  It has to outlive the Minefields using it.
+*/
+class MinefieldPool {
+ public:
+  MinefieldPool();
+  ~MinefieldPool();
+
+  // Returns a buffer of at least n bytes, and its real size in capacity
+  unsigned char *take(const size_t n, size_t &capacity);
+
+  // Hands a buffer from take() back to the pool
+  void give(unsigned char *buffer, const size_t capacity);
+
+  // Swap spare scratch vectors in and out.  takeVector() leaves v as it
+  // was if there's no spare.
+  void takeVector(std::vector<size_t> &v);
+  void takeVector(std::vector<uint32_t> &v);
+  void takeVector(std::vector<unsigned char> &v);
+  void takeVector(std::vector<mf_change_t> &v);
+  void giveVector(std::vector<size_t> &v);
+  void giveVector(std::vector<uint32_t> &v);
+  void giveVector(std::vector<unsigned char> &v);
+  void giveVector(std::vector<mf_change_t> &v);
+
+  // Number of buffers the pool has had to allocate
+  size_t allocations() const { return num_allocations; }
+
+ private:
+  // Spare buffers and their sizes
+  std::vector<std::pair<size_t, unsigned char *> > buffers;
+
+  // Spare vectors of each type
+  std::vector<std::vector<size_t> > size_vectors;
+  std::vector<std::vector<uint32_t> > label_vectors;
+  std::vector<std::vector<unsigned char> > byte_vectors;
+  std::vector<std::vector<mf_change_t> > change_vectors;
+
+  size_t num_allocations;
+
+  // Held by every call that changes the spare lists
+  std::mutex lock;
+};
+
+#endif
@@ -0,0 +1,1025 @@
+/*
+  minefieldprobability.cpp
+
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+#include "minefieldprobability.h"
+#include "parallel.h"
+#include "rng.h"
+
+const size_t MinefieldProbability::NO_CELL;
+
+// Steps the search may take on a component by default
+static const size_t DEFAULT_STEPS = size_t(1) << 22;
+
+MinefieldProbability::MinefieldProbability(MinefieldSolver &s) : solver(s), step_limit(DEFAULT_STEPS),
+								  interior_probability(0.0),
+								  interior_cells(0), mines_left(0),
+								  caching(true), cache_hits(0), cache_misses(0),
+								  count_time(0.0), last_count_time(0.0),
+								  hit_time(0.0), miss_time(0.0) {
+}
+
+/*!
+  compute() doesn't update the solver; it works from whatever the solver
+  saw last.  If it fails, probability() returns NaN for the cells that
+  aren't proven or open until the next compute() that succeeds.
+*/
+bool MinefieldProbability::compute() {
+  findComponents();
+  if (countComponents() && combine()) {
+    return true;
+  }
+  invalidate();
+  return false;
+}
+
+void MinefieldProbability::setCaching(const bool on) {
+  caching = on;
+  if (!caching) {
+    cached.clear();
+    cache.clear();
+  }
+}
+
+/*!
+  A component is taken from the cache if one there has the same key and
+  as many cells and constraints; with 64 bit keys a collision that
+  matches those too isn't going to happen.  One that went over the
+  limit is taken too, unless the limit has gone up since.  It's swapped
+  out of the last components, rather than copied, and what's left of
+  them is dropped, so the cache only ever holds the current frontier.
+
+  The biggest components go first, so the threads finish together.
+*/
+bool MinefieldProbability::countComponents() {
+  typedef std::chrono::steady_clock clock;
+  clock::time_point start = clock::now();
+  cache.clear();
+  for (size_t i=0; i<cached.size(); ++i) {
+    cache[cached[i].key] = i;
+  }
+
+  std::vector<size_t> order;
+  for (size_t c=0; c<comps.size(); ++c) {
+    std::unordered_map<uint64_t, size_t>::iterator found = cache.find(comps[c].key);
+    if (found != cache.end()) {
+      mf_component_t &old = cached[found->second];
+      if (old.cells.size() == comps[c].cells.size()
+	  && old.mines_needed.size() == comps[c].mines_needed.size()
+	  && (old.exact || old.limit >= step_limit)) {
+	std::swap(comps[c], old);
+	cache.erase(found);
+	++cache_hits;
+	continue;
+      }
+    }
+    comps[c].limit = step_limit;
+    order.push_back(c);
+    ++cache_misses;
+  }
+  cached.clear();
+  cache.clear();
+  clock::time_point looked = clock::now();
+  hit_time += std::chrono::duration<double>(looked - start).count();
+
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return comps[a].cells.size() > comps[b].cells.size();
+    });
+  parallelFor(order.size(), [&](size_t i, unsigned) {
+      comps[order[i]].exact = countSolutions(comps[order[i]]);
+    });
+
+  bool exact = true;
+  for (size_t c=0; c<comps.size(); ++c) {
+    exact = exact && comps[c].exact;
+  }
+
+  clock::time_point counted = clock::now();
+  miss_time += std::chrono::duration<double>(counted - looked).count();
+  last_count_time = std::chrono::duration<double>(counted - start).count();
+  count_time += last_count_time;
+  return exact;
+}
+
+void MinefieldProbability::invalidate() {
+  frontier_probability.assign(frontier_cells.size(), std::numeric_limits<double>::quiet_NaN());
+  interior_probability = std::numeric_limits<double>::quiet_NaN();
+}
+
+double MinefieldProbability::probability(const size_t index) const {
+  if (index >= frontier_slot.size()) {
+    throw std::runtime_error("Invalid index");
+  }
+
+  if (frontier_slot[index] != NO_CELL) {
+    return frontier_probability[frontier_slot[index]];
+  }
+  if (solver.isMine(index)) {
+    return 1.0;
+  }
+
+  Minefield &mf = solver.board();
+  size_t x, y, z;
+  mf.cellPosition(index, x, y, z);
+  if (solver.isSafe(index) || mf.getState(x,y,z) == open) {
+    return 0.0;
+  }
+  return interior_probability;
+}
+
+/*!
+  Proven safe cells come first.  An interior cell is only looked for if
+  the interior beats the frontier.
+*/
+bool MinefieldProbability::safestCell(size_t &index) const {
+  Minefield &mf = solver.board();
+  const std::vector<size_t> &safe = solver.safeCells();
+  for (size_t i=0; i<safe.size(); ++i) {
+    size_t x, y, z;
+    mf.cellPosition(safe[i], x, y, z);
+    if (mf.getState(x,y,z) == closed || mf.getState(x,y,z) == closed_bomb) {
+      index = safe[i];
+      return true;
+    }
+  }
+
+  bool found = false;
+  double best = 2.0;
+  for (size_t i=0; i<frontier_cells.size(); ++i) {
+    size_t x, y, z;
+    mf.cellPosition(frontier_cells[i], x, y, z);
+    mf_state_t st = mf.getState(x,y,z);
+    if (frontier_probability[i] < best && (st == closed || st == closed_bomb)) {
+      best = frontier_probability[i];
+      index = frontier_cells[i];
+      found = true;
+    }
+  }
+
+  if (interior_cells > 0 && (!found || interior_probability < best)) {
+    for (const mf_run_t &run : mf.runs(CLOSED_RUNS)) {
+      size_t first = mf.cellIndex(run.x, run.y, run.z);
+      for (size_t i=first; i<first+run.length; ++i) {
+	if (frontier_slot[i] == NO_CELL && !solver.isMine(i) && !solver.isSafe(i)) {
+	  index = i;
+	  return true;
+	}
+      }
+    }
+  }
+  return found;
+}
+
+/*!
+  A Zobrist style hash of a constraint: each cell's linear index hashes
+  to a random looking key, and the constraint's key mixes the XOR of
+  its cells' keys with the mines it needs.  A component's key is the
+  sum of its constraints' keys, so it doesn't depend on their order,
+  and two identical constraints don't cancel out.
+*/
+static uint64_t constraintKey(const size_t *frontier_cells, const size_t *members,
+			      const size_t n, const int mines) {
+  uint64_t cells = 0;
+  for (size_t i=0; i<n; ++i) {
+    uint64_t state = frontier_cells[members[i]];
+    cells ^= splitmix64(state);
+  }
+  uint64_t state = cells + uint64_t(mines);
+  return splitmix64(state);
+}
+
+/*!
+  Two of the solver's constraints are in the same component if they share
+  a cell, which a union-find over the cells sorts out.  Each component's
+  cells are then put in breadth first order, so that the cells of each
+  constraint come close together and the search can close it off soon,
+  and cells that are in the same constraints are put in a class.
+
+  The closed cells that are neither proven nor on the frontier are the
+  interior, and the mines not proven are shared between the two.
+*/
+void MinefieldProbability::findComponents() {
+  Minefield &mf = solver.board();
+  size_t board_cells = mf.width()*mf.height()*mf.depth();
+  size_t proven = solver.mineCells().size();
+  size_t total = size_t(mf.totalMines());
+  mines_left = (total > proven) ? total - proven : 0;
+  if (frontier_slot.size() != board_cells) {
+    frontier_slot.assign(board_cells, NO_CELL);
+  } else {
+    for (size_t i=0; i<frontier_cells.size(); ++i) {
+      frontier_slot[frontier_cells[i]] = NO_CELL;
+    }
+  }
+  frontier_cells.clear();
+
+  // Each constraint's cells, numbered in the order they're first seen
+  const std::vector<size_t> &frontier = solver.frontier();
+  std::vector<size_t> start(1, 0);
+  std::vector<size_t> members;
+  std::vector<int> needed;
+  for (size_t f=0; f<frontier.size(); ++f) {
+    size_t cells[26];
+    int mines;
+    size_t n = solver.constraint(frontier[f], cells, mines);
+    for (size_t i=0; i<n; ++i) {
+      if (frontier_slot[cells[i]] == NO_CELL) {
+	frontier_slot[cells[i]] = frontier_cells.size();
+	frontier_cells.push_back(cells[i]);
+      }
+      members.push_back(frontier_slot[cells[i]]);
+    }
+    start.push_back(members.size());
+    needed.push_back(mines);
+  }
+  size_t num_cells = frontier_cells.size();
+  size_t num_constraints = needed.size();
+  // Every count here is from the solver's view, which the board may have
+  // moved past since, so they're disjoint and the interior can't go
+  // below zero
+  interior_cells = board_cells - solver.openCells() - proven - solver.safeCells().size() - num_cells;
+
+  std::vector<size_t> parent(num_cells);
+  std::iota(parent.begin(), parent.end(), size_t(0));
+  auto root = [&](size_t v) {
+    while (parent[v] != v) {
+      parent[v] = parent[parent[v]];
+      v = parent[v];
+    }
+    return v;
+  };
+  for (size_t c=0; c<num_constraints; ++c) {
+    for (size_t i=start[c]+1; i<start[c+1]; ++i) {
+      parent[root(members[i])] = root(members[start[c]]);
+    }
+  }
+
+  // The constraints each cell is in
+  std::vector<size_t> cell_start(num_cells+1, 0);
+  for (size_t i=0; i<members.size(); ++i) {
+    ++cell_start[members[i]+1];
+  }
+  std::partial_sum(cell_start.begin(), cell_start.end(), cell_start.begin());
+  std::vector<size_t> cell_constraints(members.size());
+  std::vector<size_t> fill(cell_start.begin(), cell_start.end()-1);
+  for (size_t c=0; c<num_constraints; ++c) {
+    for (size_t i=start[c]; i<start[c+1]; ++i) {
+      cell_constraints[fill[members[i]]++] = c;
+    }
+  }
+
+  // Number the components, and each cell within its component, keeping
+  // the last ones for countComponents() to look in
+  if (caching) {
+    cached.swap(comps);
+  }
+  comps.clear();
+  std::vector<size_t> comp_of(num_cells, NO_CELL);
+  std::vector<size_t> local(num_cells, NO_CELL);
+  std::vector<size_t> queue;
+  for (size_t v=0; v<num_cells; ++v) {
+    if (local[v] != NO_CELL) continue;
+
+    comps.push_back(mf_component_t());
+    mf_component_t &comp = comps.back();
+    comp.exact = false;
+    comp.limit = 0;
+    comp.key = 0;
+    comp.constraint_start.assign(1, 0);
+    queue.assign(1, v);
+    local[v] = 0;
+    for (size_t head=0; head<queue.size(); ++head) {
+      size_t u = queue[head];
+      comp_of[u] = comps.size()-1;
+      comp.cells.push_back(frontier_cells[u]);
+      for (size_t j=cell_start[u]; j<cell_start[u+1]; ++j) {
+	size_t c = cell_constraints[j];
+	for (size_t i=start[c]; i<start[c+1]; ++i) {
+	  if (local[members[i]] == NO_CELL) {
+	    local[members[i]] = queue.size();
+	    queue.push_back(members[i]);
+	  }
+	}
+      }
+    }
+
+    // Cells in the same constraints make a class
+    std::map<std::vector<size_t>, uint32_t> classes;
+    std::vector<size_t> in;
+    for (size_t head=0; head<queue.size(); ++head) {
+      size_t u = queue[head];
+      in.assign(cell_constraints.begin() + cell_start[u], cell_constraints.begin() + cell_start[u+1]);
+      std::map<std::vector<size_t>, uint32_t>::iterator found = classes.find(in);
+      if (found == classes.end()) {
+	found = classes.insert(std::make_pair(in, uint32_t(comp.class_size.size()))).first;
+	comp.class_size.push_back(0);
+      }
+      comp.cell_class.push_back(found->second);
+      ++comp.class_size[found->second];
+    }
+  }
+
+  for (size_t c=0; c<num_constraints; ++c) {
+    if (start[c] == start[c+1]) continue;
+    mf_component_t &comp = comps[comp_of[members[start[c]]]];
+    size_t first = comp.constraint_classes.size();
+    for (size_t i=start[c]; i<start[c+1]; ++i) {
+      uint32_t cls = comp.cell_class[local[members[i]]];
+      if (std::find(comp.constraint_classes.begin() + first, comp.constraint_classes.end(), cls)
+	  == comp.constraint_classes.end()) {
+	comp.constraint_classes.push_back(cls);
+      }
+    }
+    comp.constraint_start.push_back(comp.constraint_classes.size());
+    comp.mines_needed.push_back(needed[c]);
+    comp.key += constraintKey(&frontier_cells[0], &members[start[c]], start[c+1] - start[c], needed[c]);
+  }
+}
+
+/*!
+  The search for countSolutions().  Each class in turn is given a
+  number of mines, and each constraint keeps the mines it still needs
+  and the cells it has left, so only numbers that leave every
+  constraint able to be met are tried.  A class of s cells with j mines
+  stands for C(s, j) arrangements, which is the weight it adds.
+*/
+struct SolutionSearch {
+  mf_component_t &comp;
+  size_t steps;
+  size_t limit;
+
+  // The constraints each class is in
+  std::vector<size_t> class_start;
+  std::vector<uint32_t> class_constraints;
+
+  // Mines each constraint still needs, and cells it has left
+  std::vector<int> need;
+  std::vector<int> left;
+
+  // Mines given to each class on the current branch, and their total
+  std::vector<uint32_t> chosen;
+  size_t mines;
+
+  // binomial[s][j] is C(s, j)
+  std::vector<std::vector<double> > binomial;
+
+  SolutionSearch(mf_component_t &c, size_t l) : comp(c), steps(0), limit(l), mines(0) {
+    size_t num_classes = comp.class_size.size();
+    size_t num_constraints = comp.mines_needed.size();
+    class_start.assign(num_classes+1, 0);
+    for (size_t i=0; i<comp.constraint_classes.size(); ++i) {
+      ++class_start[comp.constraint_classes[i]+1];
+    }
+    std::partial_sum(class_start.begin(), class_start.end(), class_start.begin());
+    class_constraints.resize(comp.constraint_classes.size());
+    std::vector<size_t> fill(class_start.begin(), class_start.end()-1);
+    need.resize(num_constraints);
+    left.assign(num_constraints, 0);
+    for (size_t k=0; k<num_constraints; ++k) {
+      need[k] = comp.mines_needed[k];
+      for (size_t i=comp.constraint_start[k]; i<comp.constraint_start[k+1]; ++i) {
+	left[k] += int(comp.class_size[comp.constraint_classes[i]]);
+	class_constraints[fill[comp.constraint_classes[i]]++] = uint32_t(k);
+      }
+    }
+    chosen.assign(num_classes, 0);
+
+    uint32_t biggest = *std::max_element(comp.class_size.begin(), comp.class_size.end());
+    binomial.resize(biggest+1);
+    for (size_t s=0; s<=biggest; ++s) {
+      binomial[s].assign(s+1, 1.0);
+      for (size_t j=1; j<s; ++j) {
+	binomial[s][j] = binomial[s-1][j-1] + binomial[s-1][j];
+      }
+    }
+  }
+
+  // Searches from class cls onwards, with weight for the classes before
+  // it.  Returns false if the limit ran out.
+  bool search(size_t cls, double weight) {
+    if (++steps > limit) return false;
+
+    size_t num_classes = comp.class_size.size();
+    if (cls == num_classes) {
+      comp.solutions[mines] += weight;
+      std::vector<double> &by_class = comp.class_mines[mines];
+      if (by_class.empty()) {
+	by_class.assign(num_classes, 0.0);
+      }
+      for (size_t i=0; i<num_classes; ++i) {
+	by_class[i] += weight * chosen[i];
+      }
+      return true;
+    }
+
+    // Each constraint needs between need - (left - size) and need mines
+    // from this class
+    int size = int(comp.class_size[cls]);
+    int low = 0, high = size;
+    for (size_t j=class_start[cls]; j<class_start[cls+1]; ++j) {
+      size_t c = class_constraints[j];
+      low = std::max(low, need[c] - (left[c] - size));
+      high = std::min(high, need[c]);
+    }
+
+    for (int value=low; value<=high; ++value) {
+      for (size_t j=class_start[cls]; j<class_start[cls+1]; ++j) {
+	need[class_constraints[j]] -= value;
+	left[class_constraints[j]] -= size;
+      }
+      chosen[cls] = uint32_t(value);
+      mines += size_t(value);
+      bool finished = search(cls+1, weight * binomial[size][value]);
+      mines -= size_t(value);
+      chosen[cls] = 0;
+      for (size_t j=class_start[cls]; j<class_start[cls+1]; ++j) {
+	need[class_constraints[j]] += value;
+	left[class_constraints[j]] += size;
+      }
+      if (!finished) return false;
+    }
+    return true;
+  }
+};
+
+/*!
+  The dynamic program countSolutions() falls back on.  The classes are
+  given their numbers of mines in order, as in SolutionSearch, and
+  between class i-1 and class i the constraints that have classes on
+  both sides are open.  How the rest can be filled in only depends on
+  what those still need, so the partial solutions with the same needs
+  are counted together: a forward pass counts them by number of mines,
+  for each set of needs at each step, and a backward pass counts the
+  ways of finishing from each, and multiplies the two together for
+  each class's number of mines.  The search does the same work once
+  for every partial solution, which on a long, thin component is
+  exponentially many times.
+*/
+struct FrontierCount {
+  mf_component_t &comp;
+  size_t steps;
+  size_t limit;
+
+  // The constraints each class is in, and the cells they have in it
+  // and the classes after it
+  std::vector<size_t> class_start;
+  std::vector<uint32_t> class_constraints;
+  std::vector<int> left;
+
+  // The open constraints before each class, in order, and the class
+  // each constraint ends at
+  std::vector<std::vector<uint32_t> > open;
+  std::vector<size_t> last_class;
+
+  // Each set of needs of the open constraints before class i, with its
+  // partial solutions by number of mines, and then the ways of
+  // finishing from it by number of mines to come
+  typedef std::unordered_map<std::string, size_t> NeedsIndex;
+  std::vector<NeedsIndex> needs;
+  std::vector<std::vector<std::vector<double> > > before;
+  std::vector<std::vector<double> > after;
+
+  std::vector<std::vector<double> > binomial;
+
+  // Scratch for each(): the needs of a class's constraints, and the
+  // needs it leaves
+  std::vector<int> need;
+  std::string following;
+
+  FrontierCount(mf_component_t &c, size_t l) : comp(c), steps(0), limit(l) {
+    size_t num_classes = comp.class_size.size();
+    size_t num_constraints = comp.mines_needed.size();
+    class_start.assign(num_classes+1, 0);
+    for (size_t i=0; i<comp.constraint_classes.size(); ++i) {
+      ++class_start[comp.constraint_classes[i]+1];
+    }
+    std::partial_sum(class_start.begin(), class_start.end(), class_start.begin());
+    class_constraints.resize(comp.constraint_classes.size());
+    std::vector<size_t> fill(class_start.begin(), class_start.end()-1);
+    for (size_t k=0; k<num_constraints; ++k) {
+      for (size_t i=comp.constraint_start[k]; i<comp.constraint_start[k+1]; ++i) {
+	class_constraints[fill[comp.constraint_classes[i]]++] = uint32_t(k);
+      }
+    }
+
+    // Each constraint's cells from each of its classes onwards
+    left.resize(class_constraints.size());
+    std::vector<int> remaining(num_constraints, 0);
+    std::vector<size_t> first_class(num_constraints, num_classes);
+    last_class.assign(num_constraints, 0);
+    for (size_t cls=num_classes; cls-- > 0;) {
+      for (size_t j=class_start[cls]; j<class_start[cls+1]; ++j) {
+	uint32_t k = class_constraints[j];
+	remaining[k] += int(comp.class_size[cls]);
+	left[j] = remaining[k];
+	first_class[k] = cls;
+	last_class[k] = std::max(last_class[k], cls);
+      }
+    }
+    open.resize(num_classes+1);
+    for (size_t k=0; k<num_constraints; ++k) {
+      for (size_t cls=first_class[k]+1; cls<=last_class[k]; ++cls) {
+	open[cls].push_back(uint32_t(k));
+      }
+    }
+
+    uint32_t biggest = *std::max_element(comp.class_size.begin(), comp.class_size.end());
+    binomial.resize(biggest+1);
+    for (size_t s=0; s<=biggest; ++s) {
+      binomial[s].assign(s+1, 1.0);
+      for (size_t j=1; j<s; ++j) {
+	binomial[s][j] = binomial[s-1][j-1] + binomial[s-1][j];
+      }
+    }
+  }
+
+  // Calls f(value, next) for each number of mines class cls can have
+  // with the given needs, with the needs that leaves.  Returns false if
+  // the limit ran out.
+  template <class F>
+  bool each(const size_t cls, const std::string &key, F f) {
+    const std::vector<uint32_t> &now = open[cls];
+    const std::vector<uint32_t> &next = open[cls+1];
+    need.resize(class_start[cls+1] - class_start[cls]);
+    int size = int(comp.class_size[cls]);
+    int low = 0, high = size;
+    for (size_t j=class_start[cls]; j<class_start[cls+1]; ++j) {
+      uint32_t k = class_constraints[j];
+      std::vector<uint32_t>::const_iterator at = std::lower_bound(now.begin(), now.end(), k);
+      int n = (at != now.end() && *at == k) ? int((unsigned char)key[at - now.begin()]) : comp.mines_needed[k];
+      need[j - class_start[cls]] = n;
+      low = std::max(low, n - (left[j] - size));
+      high = std::min(high, n);
+    }
+
+    following.resize(next.size());
+    for (int value=low; value<=high; ++value) {
+      if (++steps > limit) return false;
+      size_t j = class_start[cls];
+      for (size_t o=0, p=0; o<next.size(); ++o) {
+	uint32_t k = next[o];
+	while (j < class_start[cls+1] && class_constraints[j] < k) ++j;
+	if (j < class_start[cls+1] && class_constraints[j] == k) {
+	  following[o] = char(need[j - class_start[cls]] - value);
+	} else {
+	  while (now[p] < k) ++p;
+	  following[o] = key[p];
+	}
+      }
+      f(value, following);
+    }
+    return true;
+  }
+
+  // Counts everything.  Returns false if the limit ran out.
+  bool count() {
+    size_t num_classes = comp.class_size.size();
+    needs.assign(num_classes+1, NeedsIndex());
+    before.assign(num_classes+1, std::vector<std::vector<double> >());
+    needs[0][std::string()] = 0;
+    before[0].assign(1, std::vector<double>(1, 1.0));
+
+    for (size_t cls=0; cls<num_classes; ++cls) {
+      for (NeedsIndex::const_iterator it=needs[cls].begin(); it!=needs[cls].end(); ++it) {
+	const std::vector<double> &from = before[cls][it->second];
+	bool finished = each(cls, it->first, [&](int value, const std::string &next) {
+	    std::pair<NeedsIndex::iterator, bool> found =
+	      needs[cls+1].insert(std::make_pair(next, before[cls+1].size()));
+	    if (found.second) {
+	      before[cls+1].push_back(std::vector<double>());
+	    }
+	    std::vector<double> &to = before[cls+1][found.first->second];
+	    if (to.size() < from.size() + value) {
+	      to.resize(from.size() + value, 0.0);
+	    }
+	    double ways = binomial[comp.class_size[cls]][value];
+	    for (size_t k=0; k<from.size(); ++k) {
+	      to[k+value] += from[k] * ways;
+	    }
+	    steps += from.size();
+	  });
+	if (!finished || steps > limit) return false;
+      }
+    }
+
+    // Every constraint is closed by the end, so there's one set of needs
+    if (before[num_classes].empty()) return true;
+    const std::vector<double> &all = before[num_classes][0];
+    for (size_t k=0; k<all.size(); ++k) {
+      comp.solutions[k] = all[k];
+    }
+
+    after.assign(1, std::vector<double>(1, 1.0));
+    for (size_t cls=num_classes; cls-- > 0;) {
+      std::vector<std::vector<double> > here(before[cls].size());
+      for (NeedsIndex::const_iterator it=needs[cls].begin(); it!=needs[cls].end(); ++it) {
+	const std::vector<double> &from = before[cls][it->second];
+	std::vector<double> &ways_on = here[it->second];
+	bool finished = each(cls, it->first, [&](int value, const std::string &next) {
+	    NeedsIndex::const_iterator found = needs[cls+1].find(next);
+	    const std::vector<double> &rest = after[found->second];
+	    if (rest.empty()) return;
+	    double ways = binomial[comp.class_size[cls]][value];
+	    if (ways_on.size() < rest.size() + value) {
+	      ways_on.resize(rest.size() + value, 0.0);
+	    }
+	    for (size_t k=0; k<rest.size(); ++k) {
+	      ways_on[k+value] += rest[k] * ways;
+	    }
+	    if (value == 0) return;
+
+	    // Solutions through here with k mines in all
+	    double mines = ways * value;
+	    for (size_t k=0; k<from.size(); ++k) {
+	      if (from[k] == 0.0) continue;
+	      for (size_t m=0; m<rest.size(); ++m) {
+		if (rest[m] == 0.0) continue;
+		std::vector<double> &by_class = comp.class_mines[k + value + m];
+		if (by_class.empty()) {
+		  by_class.assign(num_classes, 0.0);
+		}
+		by_class[cls] += from[k] * rest[m] * mines;
+	      }
+	    }
+	    steps += from.size() * rest.size();
+	  });
+	if (!finished || steps > limit) return false;
+      }
+      after.swap(here);
+    }
+    return true;
+  }
+};
+
+// FrontierCount's steps, which are mostly single multiply-adds, for
+// each of the search's
+static const size_t FRONTIER_STEPS = 4;
+
+/*!
+  The search is tried first, since it's quicker on small components,
+  and FrontierCount if the search runs out of steps.  The counts are
+  scaled down so the biggest is 1, which keeps them in range however
+  many solutions there are; only their ratios matter.
+*/
+bool MinefieldProbability::countSolutions(mf_component_t &comp) const {
+  size_t n = comp.cells.size();
+  comp.solutions.assign(n+1, 0.0);
+  comp.class_mines.assign(n+1, std::vector<double>());
+
+  SolutionSearch search(comp, step_limit);
+  if (!search.search(0, 1.0)) {
+    comp.solutions.assign(n+1, 0.0);
+    comp.class_mines.assign(n+1, std::vector<double>());
+    FrontierCount frontier(comp, step_limit*FRONTIER_STEPS);
+    if (!frontier.count()) {
+      return false;
+    }
+  }
+
+  double biggest = *std::max_element(comp.solutions.begin(), comp.solutions.end());
+  if (!std::isfinite(biggest)) {
+    return false;
+  }
+  if (biggest > 0.0) {
+    for (size_t k=0; k<=n; ++k) {
+      comp.solutions[k] /= biggest;
+    }
+    for (size_t k=0; k<=n; ++k) {
+      for (size_t i=0; i<comp.class_mines[k].size(); ++i) {
+	comp.class_mines[k][i] /= biggest;
+      }
+    }
+  }
+  return true;
+}
+
+// Coefficients smaller than this, next to the biggest, are dropped
+static const double NEGLIGIBLE = 1e-30;
+
+// balancedLogOdds() takes at most ODDS_STEPS steps of Newton's method,
+// each moving log t by at most MAX_ODDS_STEP, and keeps it within
+// MAX_LOG_ODDS of 0
+static const size_t ODDS_STEPS = 64;
+static const double MAX_ODDS_STEP = 1.0;
+static const double MAX_LOG_ODDS = 40.0;
+
+/*!
+  The number of ways of placing each number of mines, from offset up,
+  scaled so the biggest is 1.  Once a few components are multiplied
+  together nearly all the ways are within a few standard deviations of
+  the middle, so the negligible ends are trimmed off, which keeps the
+  work in proportion to that spread rather than to the frontier.
+*/
+struct MineCounts {
+  size_t offset;
+  std::vector<double> ways;
+};
+
+// Scales counts so the biggest is 1 and trims the negligible ends
+static void trim(MineCounts &counts) {
+  std::vector<double> &w = counts.ways;
+  double biggest = w.empty() ? 0.0 : *std::max_element(w.begin(), w.end());
+  if (!(biggest > 0.0)) {
+    w.clear();
+    return;
+  }
+  size_t first = 0, last = w.size();
+  while (w[first] < biggest*NEGLIGIBLE) ++first;
+  while (w[last-1] < biggest*NEGLIGIBLE) --last;
+  for (size_t i=first; i<last; ++i) {
+    w[i-first] = w[i] / biggest;
+  }
+  w.resize(last-first);
+  counts.offset += first;
+}
+
+// Multiplies two sets of counts, keeping the numbers of mines up to limit
+static MineCounts multiply(const MineCounts &a, const MineCounts &b, const size_t limit) {
+  MineCounts product;
+  product.offset = a.offset + b.offset;
+  if (a.ways.empty() || b.ways.empty() || product.offset > limit) {
+    return product;
+  }
+  size_t size = std::min(a.ways.size() + b.ways.size() - 1, limit - product.offset + 1);
+  product.ways.assign(size, 0.0);
+  for (size_t i=0; i<a.ways.size() && i<size; ++i) {
+    for (size_t k=0; k<b.ways.size() && i+k<size; ++k) {
+      product.ways[i+k] += a.ways[i] * b.ways[k];
+    }
+  }
+  trim(product);
+  return product;
+}
+
+/*!
+  combine() weighs the components, then works out each cell's
+  probability from its component's counts and weights.
+*/
+bool MinefieldProbability::combine() {
+  std::vector<std::vector<double> > log_weights;
+  if (!weigh(log_weights)) {
+    return false;
+  }
+  frontier_probability.assign(frontier_cells.size(), 0.0);
+  for (size_t c=0; c<comps.size(); ++c) {
+    if (!applyWeights(comps[c], log_weights[c])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Multiplies each count by t^k, working in logs, since t^k alone can be
+// out of range
+static MineCounts tilt(const std::vector<double> &counts, const double log_t) {
+  MineCounts tilted;
+  tilted.offset = 0;
+  tilted.ways.assign(counts.size(), 0.0);
+  double top = -std::numeric_limits<double>::infinity();
+  for (size_t k=0; k<counts.size(); ++k) {
+    if (counts[k] > 0.0) {
+      top = std::max(top, std::log(counts[k]) + double(k)*log_t);
+    }
+  }
+  for (size_t k=0; k<counts.size(); ++k) {
+    if (counts[k] > 0.0) {
+      tilted.ways[k] = std::exp(std::log(counts[k]) + double(k)*log_t - top);
+    }
+  }
+  trim(tilted);
+  return tilted;
+}
+
+/*!
+  The odds of a mine at the density of mines left are a good start, but
+  when the frontier's constraints make it hold more or fewer than its
+  share, the interior has to make up the difference, far from where its
+  own counts peak at those odds.  So Newton's method moves log t until
+  the components' and the interior's expected numbers of mines, with
+  each count multiplied by t^k, add up to the mines left.  The
+  derivative of each expected number is its variance, which is worked
+  out about the biggest term, so it doesn't cancel away.
+*/
+double MinefieldProbability::balancedLogOdds(double log_t) const {
+  std::vector<std::vector<double> > log_counts(comps.size());
+  for (size_t c=0; c<comps.size(); ++c) {
+    const std::vector<double> &counts = comps[c].solutions;
+    log_counts[c].assign(counts.size(), -std::numeric_limits<double>::infinity());
+    for (size_t k=0; k<counts.size(); ++k) {
+      if (counts[k] > 0.0) {
+	log_counts[c][k] = std::log(counts[k]);
+      }
+    }
+  }
+
+  for (size_t step=0; step<ODDS_STEPS; ++step) {
+    double mean = 0.0, variance = 0.0;
+    for (size_t c=0; c<log_counts.size(); ++c) {
+      const std::vector<double> &lc = log_counts[c];
+      double top = -std::numeric_limits<double>::infinity();
+      size_t peak = 0;
+      for (size_t k=0; k<lc.size(); ++k) {
+	if (lc[k] + double(k)*log_t > top) {
+	  top = lc[k] + double(k)*log_t;
+	  peak = k;
+	}
+      }
+      if (!(top > -std::numeric_limits<double>::infinity())) continue;
+      double total = 0.0, first = 0.0, second = 0.0;
+      for (size_t k=0; k<lc.size(); ++k) {
+	if (!(lc[k] > -std::numeric_limits<double>::infinity())) continue;
+	double w = std::exp(lc[k] + double(k)*log_t - top);
+	double d = double(k) - double(peak);
+	total += w;
+	first += w*d;
+	second += w*d*d;
+      }
+      double shift = first/total;
+      mean += double(peak) + shift;
+      variance += second/total - shift*shift;
+    }
+    double p = 1.0/(1.0 + std::exp(-log_t));
+    mean += double(interior_cells)*p;
+    variance += double(interior_cells)*p*(1.0 - p);
+
+    double miss = mean - double(mines_left);
+    if (std::abs(miss) < 0.5 || !(variance > 0.0)) break;
+    double change = std::min(std::max(-miss/variance, -MAX_ODDS_STEP), MAX_ODDS_STEP);
+    log_t = std::min(std::max(log_t + change, -MAX_LOG_ODDS), MAX_LOG_ODDS);
+  }
+  return log_t;
+}
+
+/*!
+  A component c that uses k mines leaves the rest to the other
+  components and the interior, so its weight is
+
+    w_c[k] = sum over i of before_c[i] * after_c[mines_left - k - i]
+
+  where before_c is the product of the components before it, as
+  polynomials in the number of mines, and after_c(m) counts the ways the
+  components after it and the interior can hold m mines.  The interior
+  holds m mines in C(interior, m) ways.  before is built forwards and
+  after backwards, each a step per component.
+
+  Every count with k mines is first multiplied by t^k, with t from
+  balancedLogOdds().  Every term of w_c[k] * t^k then has the same
+  factor of t^mines_left, which cancels out, but each polynomial peaks
+  near the number of mines it holds where the products end up.  Without
+  it C(interior, m) on a big board would peak far from there, and
+  trimming it would cut off everything that matters.  The weights come
+  back in logs, for the same reason.
+*/
+bool MinefieldProbability::weigh(std::vector<std::vector<double> > &log_weights) {
+  size_t num_comps = comps.size();
+  size_t frontier_size = frontier_cells.size();
+  size_t closed_cells = interior_cells + frontier_size;
+  double density = closed_cells ? double(mines_left) / double(closed_cells) : 0.5;
+  density = std::min(std::max(density, 1e-9), 1.0 - 1e-9);
+  double log_t = balancedLogOdds(std::log(density/(1.0 - density)));
+
+  // C(interior, m) t^m for the m that can be left to the interior
+  MineCounts ways;
+  ways.offset = (mines_left > frontier_size) ? mines_left - frontier_size : 0;
+  size_t last = std::min(mines_left, interior_cells);
+  if (ways.offset > last) {
+    return false;
+  }
+  std::vector<double> log_ways(last - ways.offset + 1);
+  for (size_t m=ways.offset; m<=last; ++m) {
+    log_ways[m-ways.offset] = std::lgamma(double(interior_cells)+1.0) - std::lgamma(double(m)+1.0)
+      - std::lgamma(double(interior_cells-m)+1.0) + double(m)*log_t;
+  }
+  double top = *std::max_element(log_ways.begin(), log_ways.end());
+  ways.ways.resize(log_ways.size());
+  for (size_t i=0; i<log_ways.size(); ++i) {
+    ways.ways[i] = std::exp(log_ways[i] - top);
+  }
+  trim(ways);
+
+  std::vector<MineCounts> tilted(num_comps);
+  for (size_t c=0; c<num_comps; ++c) {
+    tilted[c] = tilt(comps[c].solutions, log_t);
+  }
+
+  // after[c] is components c... and the interior
+  std::vector<MineCounts> after(num_comps+1);
+  after[num_comps] = ways;
+  for (size_t c=num_comps; c-- > 0;) {
+    after[c] = multiply(after[c+1], tilted[c], mines_left);
+  }
+
+  log_weights.resize(num_comps);
+  MineCounts before;
+  before.offset = 0;
+  before.ways.assign(1, 1.0);
+  for (size_t c=0; c<num_comps; ++c) {
+    const MineCounts &rest = after[c+1];
+    size_t n = comps[c].cells.size();
+    log_weights[c].assign(n+1, -std::numeric_limits<double>::infinity());
+
+    // Only the k that leave between the fewest and the most mines the
+    // rest can hold
+    size_t first = 0, last = 0;
+    if (!before.ways.empty() && !rest.ways.empty() && before.offset + rest.offset <= mines_left) {
+      size_t most = before.offset + before.ways.size()-1 + rest.offset + rest.ways.size()-1;
+      first = (most < mines_left) ? mines_left - most : 0;
+      last = std::min(n, mines_left - (before.offset + rest.offset)) + 1;
+    }
+    for (size_t k=first; k<last; ++k) {
+      double w = 0.0;
+      for (size_t i=0; i<before.ways.size(); ++i) {
+	size_t used = before.offset + i + k;
+	if (used > mines_left) break;
+	size_t m = mines_left - used;
+	if (m >= rest.offset && m - rest.offset < rest.ways.size()) {
+	  w += before.ways[i] * rest.ways[m - rest.offset];
+	}
+      }
+      if (w > 0.0) {
+	log_weights[c][k] = std::log(w) + double(k)*log_t;
+      }
+    }
+    before = multiply(before, tilted[c], mines_left);
+  }
+
+  // The interior shares out whatever the frontier leaves
+  double total = 0.0, expected = 0.0;
+  for (size_t i=0; i<before.ways.size(); ++i) {
+    if (before.offset + i > mines_left) break;
+    size_t m = mines_left - (before.offset + i);
+    if (m >= ways.offset && m - ways.offset < ways.ways.size()) {
+      double w = before.ways[i] * ways.ways[m - ways.offset];
+      total += w;
+      expected += w * double(m);
+    }
+  }
+  if (!(total > 0.0)) {
+    return false;
+  }
+  interior_probability = (interior_cells > 0) ? expected / total / double(interior_cells) : 0.0;
+  return true;
+}
+
+/*!
+  The terms are scaled by the biggest of solutions[k] * weight[k], in
+  logs, so none is out of range.  Each class's sum over k is at most
+  its size times the solutions, so it's scaled through that ratio.
+*/
+bool MinefieldProbability::applyWeights(const mf_component_t &comp,
+					const std::vector<double> &log_weight) {
+  size_t n = comp.cells.size();
+  double top = -std::numeric_limits<double>::infinity();
+  for (size_t k=0; k<=n; ++k) {
+    if (comp.solutions[k] > 0.0) {
+      top = std::max(top, std::log(comp.solutions[k]) + log_weight[k]);
+    }
+  }
+  if (!(top > -std::numeric_limits<double>::infinity())) {
+    return false;
+  }
+
+  size_t num_classes = comp.class_size.size();
+  std::vector<double> mines(num_classes, 0.0);
+  double total = 0.0;
+  for (size_t k=0; k<=n; ++k) {
+    if (!(comp.solutions[k] > 0.0)) continue;
+    double term = std::exp(std::log(comp.solutions[k]) + log_weight[k] - top);
+    total += term;
+    if (k == 0 || term == 0.0) continue;
+    for (size_t cls=0; cls<num_classes; ++cls) {
+      mines[cls] += comp.class_mines[k][cls] / comp.solutions[k] * term;
+    }
+  }
+  for (size_t v=0; v<n; ++v) {
+    uint32_t cls = comp.cell_class[v];
+    frontier_probability[frontier_slot[comp.cells[v]]] = mines[cls] / total / comp.class_size[cls];
+  }
+  return true;
+}
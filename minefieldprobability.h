@@ -0,0 +1,206 @@
+/*
+  minefieldprobability.h
+
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MINEFIELDPROBABILITY_H
+#define MINEFIELDPROBABILITY_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "minefieldsolver.h"
+
+/*!
+  A connected group of the frontier's constraints and the cells they
+  share, with the solutions found for it.  Cells that are in exactly the
+  same constraints are interchangeable, so they're counted together as a
+  class.  Cells, classes and constraints are numbered within the
+  component, in an order that closes constraints off early, for the
+  search.
+*/
+struct mf_component_t {
+  // Linear index and class of each cell, and the size of each class
+  std::vector<size_t> cells;
+  std::vector<uint32_t> cell_class;
+  std::vector<uint32_t> class_size;
+
+  // Constraint c has the classes constraint_classes[constraint_start[c]...
+  // constraint_start[c+1]] and needs mines_needed[c] mines among them
+  std::vector<size_t> constraint_start;
+  std::vector<uint32_t> constraint_classes;
+  std::vector<int> mines_needed;
+
+  // Solutions by number of mines, k = 0...cells.size(), and the mines in
+  // each class summed over those solutions, at [k][class]; class_mines[k]
+  // is empty if there are none with k.  Both are scaled so the biggest
+  // count is 1.
+  std::vector<double> solutions;
+  std::vector<std::vector<double> > class_mines;
+
+  // Whether all the solutions were found within the limit, and the
+  // limit they were counted with
+  bool exact;
+  size_t limit;
+
+  // Hash of the component's constraints, the same whichever order
+  // they're found in
+  uint64_t key;
+};
+
+/*!
+  MinefieldProbability works out the exact probability of each closed
+  cell being a mine, given what the player can see, with every
+  arrangement of the remaining mines that fits equally likely.
+
+  The frontier's constraints, from a MinefieldSolver, are split into
+  independent components, and each component's solutions are counted
+  by a search over the number of mines in each class of cells, which
+  only tries numbers every constraint can still be met with.
+  The components are searched in parallel.  The cells no constraint
+  touches, the interior, can hold any of the mines left over, so the
+  components are combined with a dynamic program over the number of
+  mines they use, each total weighted by the number of ways of placing
+  the rest in the interior.
+
+  A component with more solutions, counting a class's arrangements as
+  one, than the search can look at within the limit is counted again by
+  a dynamic program over what the constraints still need, which doesn't
+  look at each solution; if that takes too long too, compute() fails.
+
+  Most moves only change one component, so the components counted are
+  kept, keyed by a hash of their constraints, and a component with the
+  same constraints next time isn't counted again, unless setCaching()
+  has turned that off.
+*/
+class MinefieldProbability {
+ public:
+  // Works from solver, which must outlive it
+  explicit MinefieldProbability(MinefieldSolver &solver);
+
+  // Works out the probabilities for the board as the solver sees it now.
+  // Returns false if a component needed more than the limit.
+  bool compute();
+
+  // The probability that a cell, by linear index, is a mine, as of the
+  // last compute()
+  double probability(const size_t index) const;
+
+  // The probability for each cell in the interior, and how many there are
+  double interiorProbability() const { return interior_probability; }
+  size_t interiorCells() const { return interior_cells; }
+
+  // Finds a closed, unmarked cell with the lowest probability of being a
+  // mine.  Returns false if there isn't one.
+  bool safestCell(size_t &index) const;
+
+  // The components of the last compute()
+  const std::vector<mf_component_t> &components() const { return comps; }
+
+  // Sets how many steps the search can take on each component
+  void setLimit(const size_t steps) { step_limit = steps; }
+
+  // Sets whether compute() takes components it counted last time from
+  // the cache.  Turning it off empties the cache.
+  void setCaching(const bool on);
+
+  // How many components were found in the cache and how many had to be
+  // counted, over all compute()s
+  size_t cacheHits() const { return cache_hits; }
+  size_t cacheMisses() const { return cache_misses; }
+
+  // Seconds spent counting components, over all compute()s and in the
+  // last one
+  double countTime() const { return count_time; }
+  double lastCountTime() const { return last_count_time; }
+
+  // Seconds spent taking components from the cache, and counting the
+  // ones that weren't there, over all compute()s
+  double hitTime() const { return hit_time; }
+  double missTime() const { return miss_time; }
+
+ protected:
+  // frontier_slot of a cell that isn't on the frontier
+  static const size_t NO_CELL = ~size_t(0);
+
+  // Splits the frontier into components, and counts the interior
+  void findComponents();
+
+  // Counts the solutions of each component that isn't in the cache, in
+  // parallel.  Returns false if any took more than the limit.
+  bool countComponents();
+
+  // Counts the solutions of a component, by search or, if that takes
+  // more than the limit, dynamic program.  Returns false if both did.
+  bool countSolutions(mf_component_t &comp) const;
+
+  // Combines the components' counts into probabilities.  Returns false
+  // if nothing fits.
+  bool combine();
+
+  // Works out the log of the weight of each number of mines in each
+  // component, from the ways the rest of the board can hold the others,
+  // and the interior probability.  Returns false if nothing fits.
+  bool weigh(std::vector<std::vector<double> > &log_weights);
+
+  // The log of the odds weigh() multiplies counts by, starting from
+  // log_t
+  double balancedLogOdds(double log_t) const;
+
+  // Sets the probabilities of a component's cells from its counts and
+  // the log weights.  Returns false if none of its solutions has any
+  // weight.
+  bool applyWeights(const mf_component_t &comp, const std::vector<double> &log_weight);
+
+  // Makes the probabilities NaN, after a failure
+  void invalidate();
+
+  MinefieldSolver &solver;
+  size_t step_limit;
+
+  std::vector<mf_component_t> comps;
+
+  // Each frontier cell's probability, and for each cell on the board,
+  // its place in frontier_cells or NO_CELL
+  std::vector<size_t> frontier_cells;
+  std::vector<double> frontier_probability;
+  std::vector<size_t> frontier_slot;
+
+  double interior_probability;
+  size_t interior_cells;
+
+  // Mines not yet proven, for the frontier and the interior to share
+  size_t mines_left;
+
+  // findComponents() moves the last components here, for
+  // countComponents() to take any it finds again by key
+  bool caching;
+  std::vector<mf_component_t> cached;
+  std::unordered_map<uint64_t, size_t> cache;
+  size_t cache_hits;
+  size_t cache_misses;
+  double count_time;
+  double last_count_time;
+  double hit_time;
+  double miss_time;
+};
+
+#endif
@@ -0,0 +1,535 @@
+/*
+  minefieldsolver.cpp
+
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "constraintmatrix.h"
+#include "minefieldsolver.h"
+#include "parallel.h"
+
+const unsigned char MinefieldSolver::OPEN_CELL;
+const unsigned char MinefieldSolver::SAFE_CELL;
+const unsigned char MinefieldSolver::MINE_CELL;
+const unsigned char MinefieldSolver::FRONTIER_CELL;
+const unsigned char MinefieldSolver::QUEUED_CELL;
+const unsigned char MinefieldSolver::PAIR_QUEUED_CELL;
+
+// update() starts over when an operation opened more than one in this
+// many of the cells that were closed
+static const size_t REBUILD_FRACTION = 8;
+
+// A cell eliminate() hasn't given a column
+static const uint32_t NO_ID = ~uint32_t(0);
+
+/*!
+  The constructor solves what's already open on the board.
+*/
+MinefieldSolver::MinefieldSolver(Minefield &board) : mf(board) {
+  rebuild();
+}
+
+/*!
+  rebuild() forgets everything and finds the open cells again, from the
+  board's runs() so the cleared parts of the board go by a run at a time.
+  It's the only part of the solver that looks at the whole board.
+*/
+void MinefieldSolver::rebuild() {
+  wdth = mf.width();
+  hght = mf.height();
+  dpth = mf.depth();
+  board_seed = mf.seed();
+  board_stencil = mf.stencil();
+  board_topology = mf.topology();
+
+  size_t cells = wdth*hght*dpth;
+  cell_flags.assign(cells, 0);
+  unsolved_count.assign(cells, 0);
+  mines_needed.assign(cells, 0);
+  frontier_cells.clear();
+  frontier_pos.assign(cells, 0);
+  cell_id.assign(cells, NO_ID);
+  safe_cells.clear();
+  mine_cells.clear();
+  queue.clear();
+  pair_queue.clear();
+  num_open = 0;
+  num_overflowed = 0;
+
+  // Every open cell has to be known before any constraint is counted
+  for (const mf_run_t &run : mf.runs(NUMBERED_RUNS | CLEARED_RUNS)) {
+    size_t first = mf.cellIndex(run.x, run.y, run.z);
+    std::fill(cell_flags.begin()+first, cell_flags.begin()+first+run.length, OPEN_CELL);
+    num_open += run.length;
+  }
+  for (const mf_run_t &run : mf.runs(NUMBERED_RUNS)) {
+    size_t first = mf.cellIndex(run.x, run.y, run.z);
+    for (size_t i=first; i<first+run.length; ++i) {
+      addConstraint(i);
+    }
+  }
+  solve();
+}
+
+/*!
+  update() reads the cells the last operation opened from changes().  A
+  cell that's been closed again, by undo(), or a board that's been reset
+  or has opened cells the solver never heard about, makes it start over.
+  So does an operation that opened a big part of what was closed: each
+  opened cell costs more taken in on its own than in rebuild(), which
+  goes through the cleared parts of the board a run at a time.
+*/
+void MinefieldSolver::update() {
+  if (mf.width() != wdth || mf.height() != hght || mf.depth() != dpth
+      || mf.seed() != board_seed || mf.stencil() != board_stencil
+      || mf.topology() != board_topology) {
+    rebuild();
+    return;
+  }
+
+  // As in rebuild(), all the opened cells are taken in before any of
+  // them is counted as a constraint.  When more cells opened than there
+  // were constraints, it's quicker to count the old constraints again
+  // than to have each opened cell tell the constraints around it.
+  const std::vector<mf_change_t> &changes = mf.changes();
+  size_t closed_cells = wdth*hght*dpth - num_open;
+  if (changes.size()*REBUILD_FRACTION > closed_cells) {
+    rebuild();
+    return;
+  }
+  bool recount = changes.size() > frontier_cells.size();
+  for (size_t i=0; i<changes.size(); ++i) {
+    if (changes[i].state == open) {
+      opened(changes[i].index, !recount);
+    } else if (cell_flags[changes[i].index] & OPEN_CELL) {
+      rebuild();
+      return;
+    }
+  }
+  if (recount) {
+    batch.assign(frontier_cells.begin(), frontier_cells.end());
+    for (size_t i=0; i<batch.size(); ++i) {
+      addConstraint(batch[i]);
+    }
+  }
+  for (size_t i=0; i<changes.size(); ++i) {
+    if (changes[i].state == open) {
+      addConstraint(changes[i].index);
+    }
+  }
+
+  if (num_open != mf.cellsOpened()) {
+    rebuild();
+    return;
+  }
+  solve();
+}
+
+/*!
+  openSafe() is what the game's "open obvious cells" mode and the bots
+  use.  The cells are opened in batches with touchMany(), each batch
+  being whatever the last one proved safe.
+*/
+size_t MinefieldSolver::openSafe() {
+  update();
+
+  size_t total = 0;
+  for (;;) {
+    batch.clear();
+    const std::vector<size_t> &safe = safeCells();
+    for (size_t i=0; i<safe.size(); ++i) {
+      size_t x, y, z;
+      mf.cellPosition(safe[i], x, y, z);
+      mf_state_t st = mf.getState(x,y,z);
+      if (st == closed || st == closed_bomb) {
+	batch.push_back(safe[i]);
+      }
+    }
+    if (batch.empty()) {
+      if (eliminate() == 0) break;
+      continue;
+    }
+
+    size_t count = mf.touchMany(batch);
+    update();
+    if (count == 0) break;
+    total += count;
+  }
+  return total;
+}
+
+/*!
+  Drops the cells that have been opened since they were proven safe
+*/
+const std::vector<size_t> &MinefieldSolver::safeCells() {
+  size_t kept = 0;
+  for (size_t i=0; i<safe_cells.size(); ++i) {
+    if (!(cell_flags[safe_cells[i]] & OPEN_CELL)) {
+      safe_cells[kept++] = safe_cells[i];
+    }
+  }
+  safe_cells.resize(kept);
+  return safe_cells;
+}
+
+/*!
+  The cells are sorted, so two constraints' cells can be merged
+*/
+size_t MinefieldSolver::constraint(const size_t index, size_t *cells, int &mines) const {
+  size_t neighbors[26];
+  size_t n = mf.neighborIndices(index, neighbors);
+  size_t count = 0;
+  for (size_t i=0; i<n; ++i) {
+    if (unsolved(neighbors[i])) {
+      cells[count++] = neighbors[i];
+    }
+  }
+  if (board_topology == torus_topology) {
+    std::sort(cells, cells+count);
+  }
+  mines = mines_needed[index];
+  return count;
+}
+
+/*!
+  Takes a cell the board opened.  If it was one of the cells the
+  constraints around it were counting, they each have one less, if
+  they're to be told.  It's made a constraint itself afterwards.
+*/
+void MinefieldSolver::opened(const size_t index, const bool tell_neighbors) {
+  if (cell_flags[index] & OPEN_CELL) return;
+
+  bool counted = unsolved(index);
+  cell_flags[index] = (cell_flags[index] & ~SAFE_CELL) | OPEN_CELL;
+  ++num_open;
+
+  if (counted && tell_neighbors) {
+    size_t neighbors[26];
+    size_t n = mf.neighborIndices(index, neighbors);
+    for (size_t i=0; i<n; ++i) {
+      if (cell_flags[neighbors[i]] & FRONTIER_CELL) {
+	--unsolved_count[neighbors[i]];
+	touchConstraint(neighbors[i]);
+      }
+    }
+  }
+}
+
+/*!
+  Makes a numbered open cell a constraint, if it has any unsolved closed
+  neighbors, counting them and the mines among them.  For a cell that's
+  already a constraint, it counts them again.
+*/
+void MinefieldSolver::addConstraint(const size_t index) {
+  size_t x, y, z;
+  mf.cellPosition(index, x, y, z);
+  size_t near = mf.bombsNear(x,y,z);
+  if (near == 0) return;
+
+  size_t neighbors[26];
+  size_t n = mf.neighborIndices(index, neighbors);
+  size_t count = 0, mines = 0;
+  for (size_t i=0; i<n; ++i) {
+    count += unsolved(neighbors[i]);
+    mines += (cell_flags[neighbors[i]] & MINE_CELL) != 0;
+  }
+  unsolved_count[index] = count;
+  mines_needed[index] = near - mines;
+
+  if (count > 0 && !(cell_flags[index] & FRONTIER_CELL)) {
+    cell_flags[index] |= FRONTIER_CELL;
+    frontier_pos[index] = frontier_cells.size();
+    frontier_cells.push_back(index);
+  }
+  touchConstraint(index);
+}
+
+void MinefieldSolver::prove(const size_t index, const bool mine) {
+  cell_flags[index] |= (mine ? MINE_CELL : SAFE_CELL);
+  (mine ? mine_cells : safe_cells).push_back(index);
+
+  size_t neighbors[26];
+  size_t n = mf.neighborIndices(index, neighbors);
+  for (size_t i=0; i<n; ++i) {
+    if (cell_flags[neighbors[i]] & FRONTIER_CELL) {
+      --unsolved_count[neighbors[i]];
+      if (mine) {
+	--mines_needed[neighbors[i]];
+      }
+      touchConstraint(neighbors[i]);
+    }
+  }
+}
+
+void MinefieldSolver::touchConstraint(const size_t index) {
+  if (!(cell_flags[index] & FRONTIER_CELL)) return;
+
+  if (unsolved_count[index] == 0) {
+    size_t last = frontier_cells.back();
+    frontier_cells[frontier_pos[index]] = last;
+    frontier_pos[last] = frontier_pos[index];
+    frontier_cells.pop_back();
+    cell_flags[index] &= ~FRONTIER_CELL;
+  } else if (!(cell_flags[index] & QUEUED_CELL)) {
+    cell_flags[index] |= QUEUED_CELL;
+    queue.push_back(index);
+  }
+}
+
+/*!
+  Constraints are looked at on their own first, which only takes their
+  counts, and only paired up once nothing's left to do on its own.
+  Pairing takes a few hundred times as long, and often the pair would
+  have been solved by what the single constraints around it prove.
+*/
+void MinefieldSolver::solve() {
+  for (;;) {
+    if (!queue.empty()) {
+      size_t index = queue.back();
+      queue.pop_back();
+      cell_flags[index] &= ~QUEUED_CELL;
+      if ((cell_flags[index] & FRONTIER_CELL) && !deduceAlone(index)
+	  && !(cell_flags[index] & PAIR_QUEUED_CELL)) {
+	cell_flags[index] |= PAIR_QUEUED_CELL;
+	pair_queue.push_back(index);
+      }
+    } else if (!pair_queue.empty()) {
+      size_t index = pair_queue.back();
+      pair_queue.pop_back();
+      cell_flags[index] &= ~PAIR_QUEUED_CELL;
+      if ((cell_flags[index] & FRONTIER_CELL) && !deduceAlone(index)) {
+	deducePairs(index);
+      }
+    } else {
+      break;
+    }
+  }
+}
+
+/*!
+  Solves a constraint that needs no more mines, or needs all its cells to
+  be mines.  Returns false if it doesn't.
+*/
+bool MinefieldSolver::deduceAlone(const size_t index) {
+  if (mines_needed[index] != 0 && mines_needed[index] != unsolved_count[index]) {
+    return false;
+  }
+
+  size_t a[26];
+  int need_a;
+  size_t len_a = constraint(index, a, need_a);
+  for (size_t i=0; i<len_a; ++i) {
+    prove(a[i], need_a != 0);
+  }
+  return true;
+}
+
+/*!
+  Runs the deductions on one constraint, A, paired with each constraint B
+  that shares a cell with it.  Those are the frontier cells next to A's
+  cells.  Anything proven queues the constraints on the proven cells,
+  and A itself, to be looked at again.
+*/
+void MinefieldSolver::deducePairs(const size_t index) {
+  size_t a[26];
+  int need_a;
+  size_t len_a = constraint(index, a, need_a);
+
+  partners.clear();
+  for (size_t i=0; i<len_a; ++i) {
+    size_t neighbors[26];
+    size_t n = mf.neighborIndices(a[i], neighbors);
+    for (size_t j=0; j<n; ++j) {
+      if (neighbors[j] != index && (cell_flags[neighbors[j]] & FRONTIER_CELL)) {
+	partners.push_back(neighbors[j]);
+      }
+    }
+  }
+  std::sort(partners.begin(), partners.end());
+  partners.erase(std::unique(partners.begin(), partners.end()), partners.end());
+
+  for (size_t p=0; p<partners.size(); ++p) {
+    size_t b[26];
+    int need_b;
+    size_t len_b = constraint(partners[p], b, need_b);
+
+    // Split the two into the cells only A has and the cells only B has
+    size_t only_a[26], only_b[26], len_only_a = 0, len_only_b = 0;
+    size_t i = 0, j = 0;
+    while (i < len_a || j < len_b) {
+      if (j == len_b || (i < len_a && a[i] < b[j])) {
+	only_a[len_only_a++] = a[i++];
+      } else if (i == len_a || b[j] < a[i]) {
+	only_b[len_only_b++] = b[j++];
+      } else {
+	++i;
+	++j;
+      }
+    }
+    if (len_only_a == len_a) continue;
+
+    const size_t *mines = 0, *safe = 0;
+    size_t len_mines = 0, len_safe = 0;
+    if (need_b - need_a == int(len_only_b)) {
+      mines = only_b;
+      len_mines = len_only_b;
+      safe = only_a;
+      len_safe = len_only_a;
+    } else if (need_a - need_b == int(len_only_a)) {
+      mines = only_a;
+      len_mines = len_only_a;
+      safe = only_b;
+      len_safe = len_only_b;
+    }
+    if (len_mines + len_safe == 0) continue;
+
+    for (size_t k=0; k<len_mines; ++k) {
+      prove(mines[k], true);
+    }
+    for (size_t k=0; k<len_safe; ++k) {
+      prove(safe[k], false);
+    }
+    touchConstraint(index);
+    return;
+  }
+}
+
+/*!
+  The frontier is split into components of constraints that share
+  cells, and each is row reduced in its own ConstraintMatrix, in
+  parallel.  A component's cells are numbered in order of linear index,
+  so each row's columns are within a couple of planes of each other;
+  cell_id finds a cell's number without searching for it.  Components
+  of one or two constraints are left to the other rules, which already
+  find everything there is to find in them.
+*/
+size_t MinefieldSolver::eliminate() {
+  std::vector<size_t> order(frontier_cells);
+  std::sort(order.begin(), order.end());
+  size_t num_constraints = order.size();
+
+  // Each constraint's cells and mines
+  std::vector<size_t> start(1, 0);
+  std::vector<size_t> cells;
+  std::vector<int> mines(num_constraints);
+  for (size_t c=0; c<num_constraints; ++c) {
+    size_t in[26];
+    size_t n = constraint(order[c], in, mines[c]);
+    cells.insert(cells.end(), in, in+n);
+    start.push_back(cells.size());
+  }
+
+  // Number the cells, and join the constraints that share one
+  std::vector<size_t> parent(num_constraints);
+  for (size_t c=0; c<num_constraints; ++c) {
+    parent[c] = c;
+  }
+  auto root = [&](size_t c) {
+    while (parent[c] != c) {
+      parent[c] = parent[parent[c]];
+      c = parent[c];
+    }
+    return c;
+  };
+  std::vector<size_t> unique;
+  std::vector<size_t> cell_owner;
+  for (size_t c=0; c<num_constraints; ++c) {
+    for (size_t i=start[c]; i<start[c+1]; ++i) {
+      uint32_t &id = cell_id[cells[i]];
+      if (id == NO_ID) {
+	id = uint32_t(unique.size());
+	unique.push_back(cells[i]);
+	cell_owner.push_back(c);
+      } else {
+	parent[root(c)] = root(cell_owner[id]);
+      }
+    }
+  }
+
+  std::vector<std::vector<size_t> > groups;
+  std::vector<size_t> group_of(num_constraints, num_constraints);
+  for (size_t c=0; c<num_constraints; ++c) {
+    size_t r = root(c);
+    if (group_of[r] == num_constraints) {
+      group_of[r] = groups.size();
+      groups.push_back(std::vector<size_t>());
+    }
+    groups[group_of[r]].push_back(c);
+  }
+
+  // Each group's cells in order of linear index, and each cell's column
+  // in its group
+  std::vector<uint32_t> by_index(unique.size());
+  for (size_t id=0; id<unique.size(); ++id) {
+    by_index[id] = uint32_t(id);
+  }
+  std::sort(by_index.begin(), by_index.end(), [&](uint32_t a, uint32_t b) { return unique[a] < unique[b]; });
+  std::vector<std::vector<uint32_t> > columns(groups.size());
+  std::vector<uint32_t> column(unique.size());
+  for (size_t k=0; k<by_index.size(); ++k) {
+    uint32_t id = by_index[k];
+    std::vector<uint32_t> &group_columns = columns[group_of[root(cell_owner[id])]];
+    column[id] = uint32_t(group_columns.size());
+    group_columns.push_back(id);
+  }
+
+  std::vector<std::vector<uint32_t> > found(groups.size());
+  std::vector<std::vector<unsigned char> > values(groups.size());
+  std::vector<size_t> overflowed(groups.size(), 0);
+  parallelFor(groups.size(), [&](size_t g, unsigned) {
+      const std::vector<size_t> &group = groups[g];
+      if (group.size() < 3) return;
+
+      ConstraintMatrix matrix(columns[g].size());
+      for (size_t k=0; k<group.size(); ++k) {
+	uint32_t row[26];
+	size_t n = start[group[k]+1] - start[group[k]];
+	for (size_t i=0; i<n; ++i) {
+	  row[i] = column[cell_id[cells[start[group[k]]+i]]];
+	}
+	matrix.addRow(row, n, mines[group[k]]);
+      }
+      matrix.reduce();
+      overflowed[g] = matrix.overflowed();
+      matrix.forced(found[g], values[g]);
+      for (size_t i=0; i<found[g].size(); ++i) {
+	found[g][i] = columns[g][found[g][i]];
+      }
+    });
+
+  for (size_t id=0; id<unique.size(); ++id) {
+    cell_id[unique[id]] = NO_ID;
+  }
+
+  size_t proven = 0;
+  num_overflowed = 0;
+  for (size_t g=0; g<groups.size(); ++g) {
+    num_overflowed += overflowed[g];
+    for (size_t i=0; i<found[g].size(); ++i) {
+      size_t index = unique[found[g][i]];
+      if (unsolved(index)) {
+	prove(index, values[g][i] != 0);
+	++proven;
+      }
+    }
+  }
+  solve();
+  return proven;
+}
@@ -0,0 +1,188 @@
+/*
+  minefieldsolver.h
+
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MINEFIELDSOLVER_H
+#define MINEFIELDSOLVER_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#include "minefield.h"
+
+/*!
+  MinefieldSolver works out which closed cells of a Minefield are
+  certainly safe and which are certainly mines, from what the player can
+  see: which cells are open and the numbers on them.  It never looks at
+  where the mines are, and doesn't trust the player's marks.
+
+  Each numbered open cell next to closed cells nobody has solved is a
+  constraint: so many mines among those unsolved cells.  Those cells are
+  the frontier.  The deductions are:
+
+    - a constraint that needs no more mines makes all its cells safe,
+      and one that needs as many mines as it has cells makes them all
+      mines
+    - for two constraints A and B that share cells, if B needs as many
+      more mines than A as it has cells A doesn't, those cells are all
+      mines and the cells only A has are safe.  That includes the usual
+      case of A's cells being a subset of B's.
+    - eliminate() row reduces each group of the frontier's constraints
+      that share cells, with ConstraintMatrix, and finds the cells a
+      reduced row forces because the rest of it couldn't reach its
+      total otherwise.  That finds what takes three or more constraints
+      together, but costs time in proportion to the frontier, so only
+      openSafe() runs it, when the others find nothing.
+
+  update() takes the cells opened since it was last called from the
+  board's changes(), and only the constraints around them, and around
+  the cells that solves, are looked at again, so a move costs time in
+  proportion to what it changed, not to the size of the board.
+
+  Without changes(), as in concurrent mode, update() has to start over
+  after every operation.
+*/
+class MinefieldSolver {
+ public:
+  // Solves mf, which must outlive it.  update() needs mf to keep
+  // changes(), as it does unless it's told not to.
+  explicit MinefieldSolver(Minefield &mf);
+
+  // Catches up with the board.  Call it after every touch(), chord(),
+  // touchMany(), undo() or redo(); after a reset() or setNeighborhood()
+  // it starts over.
+  void update();
+
+  // Starts over from the whole board
+  void rebuild();
+
+  // Opens the cells proven safe, then the cells that proves safe, and
+  // so on until there are none, skipping any the player has marked.
+  // When the other rules run dry it tries eliminate().  Returns the
+  // number of cells opened.
+  size_t openSafe();
+
+  // Runs the linear algebra deduction over the whole frontier, as of
+  // the last update(), then the other rules on what it finds.  Returns
+  // the number of cells it proved.
+  size_t eliminate();
+
+  // How many row operations the last eliminate() left out because a
+  // coefficient would have overflowed
+  size_t overflowed() const { return num_overflowed; }
+
+  // What's been proven about a cell, by linear index
+  bool isSafe(const size_t index) const { return (cell_flags[index] & SAFE_CELL) != 0; }
+  bool isMine(const size_t index) const { return (cell_flags[index] & MINE_CELL) != 0; }
+
+  // Closed cells proven safe, and cells proven to be mines, in the order
+  // they were found
+  const std::vector<size_t> &safeCells();
+  const std::vector<size_t> &mineCells() const { return mine_cells; }
+
+  // How many cells were open as of the last update()
+  size_t openCells() const { return num_open; }
+
+  // The numbered open cells that are constraints, in no particular order
+  const std::vector<size_t> &frontier() const { return frontier_cells; }
+
+  // For a cell in the frontier, writes its unsolved closed neighbors to
+  // cells, which needs room for 26, and sets mines to how many of them
+  // are mines.  Returns how many cells there are.
+  size_t constraint(const size_t index, size_t *cells, int &mines) const;
+
+  // The board being solved
+  Minefield &board() const { return mf; }
+
+ private:
+  // Bits of cell_flags
+  static const unsigned char OPEN_CELL = 1;
+  static const unsigned char SAFE_CELL = 2;
+  static const unsigned char MINE_CELL = 4;
+  static const unsigned char FRONTIER_CELL = 8;
+  static const unsigned char QUEUED_CELL = 16;
+  static const unsigned char PAIR_QUEUED_CELL = 32;
+
+  // Whether a cell is unsolved and closed, so a constraint counts it
+  bool unsolved(const size_t index) const {
+    return !(cell_flags[index] & (OPEN_CELL | SAFE_CELL | MINE_CELL));
+  }
+
+  // Takes in a cell the board has opened, optionally telling the
+  // constraints around it
+  void opened(const size_t index, const bool tell_neighbors);
+
+  // Makes an open cell a constraint, if it is one, or counts it again
+  void addConstraint(const size_t index);
+
+  // Records a cell as safe or a mine, and queues the constraints on it
+  void prove(const size_t index, const bool mine);
+
+  // Queues a constraint for solve(), and takes it off the frontier if it
+  // has no cells left
+  void touchConstraint(const size_t index);
+
+  // Runs the deductions on the queued constraints until nothing's left
+  void solve();
+  bool deduceAlone(const size_t index);
+  void deducePairs(const size_t index);
+
+  Minefield &mf;
+
+  // The board the solver was set up for, to tell when it's been reset
+  size_t wdth;
+  size_t hght;
+  size_t dpth;
+  uint64_t board_seed;
+  mf_stencil_t board_stencil;
+  mf_topology_t board_topology;
+
+  // Per cell: flags, and for constraints, the number of unsolved closed
+  // neighbors and how many of them are mines
+  std::vector<unsigned char> cell_flags;
+  std::vector<unsigned char> unsolved_count;
+  std::vector<unsigned char> mines_needed;
+
+  // The frontier, and each frontier cell's place in it
+  std::vector<size_t> frontier_cells;
+  std::vector<size_t> frontier_pos;
+
+  // Scratch for eliminate(): each cell's number among the frontier's
+  // cells, or NO_ID
+  std::vector<uint32_t> cell_id;
+
+  // Number of cells with OPEN_CELL set
+  size_t num_open;
+
+  size_t num_overflowed;
+
+  std::vector<size_t> safe_cells;
+  std::vector<size_t> mine_cells;
+
+  // Constraints waiting for solve() to look at them on their own, and in
+  // pairs, and scratch space for deducePairs()
+  std::vector<size_t> queue;
+  std::vector<size_t> pair_queue;
+  std::vector<size_t> partners;
+  std::vector<size_t> batch;
+};
+
+#endif
@@ -0,0 +1,195 @@
+/*
+  neighborhood.h
+
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NEIGHBORHOOD_H
+#define NEIGHBORHOOD_H
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+/*
+  A stencil picks which of the 26 cells around a cell are its neighbors,
+  and a topology decides what happens at the edges of the board.  Both
+  are compile time policies: a topology wraps a layout (see
+  celllayout.h) and offers the same slots(), slot(), position() and
+  forEachNeighbor(), with forEachNeighbor() calling f only for the
+  stencil's neighbors.  Minefield's loops are templates over whatever
+  they're given, so each combination gets its own unrolled loop.
+
+  Each stencil lists its neighbors as a constexpr table of the layouts'
+  neighbor numbers (0-25, x fastest, skipping the cell itself):
+
+    SIZE         number of neighbors
+    index(i)     neighbor number of the stencil's i'th neighbor
+*/
+
+// Which cells are neighbors: those sharing a corner (26), an edge (18)
+// or a face (6)
+enum mf_stencil_t {corner_stencil, edge_stencil, face_stencil};
+
+// Whether the board stops at its edges or wraps around them
+enum mf_topology_t {bounded_topology, torus_topology};
+
+// The x, y and z steps to neighbor k, each -1, 0 or 1
+constexpr int neighborDX(size_t k) { return int((k < 13 ? k : k+1) % 3) - 1; }
+constexpr int neighborDY(size_t k) { return int((k < 13 ? k : k+1) / 3 % 3) - 1; }
+constexpr int neighborDZ(size_t k) { return int((k < 13 ? k : k+1) / 9) - 1; }
+
+/*!
+  All 26 cells of the 3x3x3 block, as in the original game
+*/
+struct CornerStencil {
+  static const size_t SIZE = 26;
+  static constexpr size_t index(size_t i) { return i; }
+};
+
+/*!
+  The 18 cells that share a face or an edge: the block without its corners
+*/
+struct EdgeStencil {
+  static const size_t SIZE = 18;
+  static constexpr size_t index(size_t i) {
+    const size_t k[SIZE] = {1, 3, 4, 5, 7, 9, 10, 11, 12, 13, 14, 15, 16, 18, 20, 21, 22, 24};
+    return k[i];
+  }
+};
+
+/*!
+  The 6 cells that share a face
+*/
+struct FaceStencil {
+  static const size_t SIZE = 6;
+  static constexpr size_t index(size_t i) {
+    const size_t k[SIZE] = {4, 10, 12, 13, 15, 21};
+    return k[i];
+  }
+};
+
+// The unrolled neighbor loops are only quick if they're inlined into the
+// loop around them, where the sums they update can stay in registers
+#if defined(__GNUC__)
+#define MF_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define MF_ALWAYS_INLINE inline
+#endif
+
+/*!
+  Calls f with the slot of each of the stencil's neighbors of slot s in
+  layout l, unrolled.  The neighbor numbers are compile time constants,
+  so each is a fixed entry of the layout's offset table, or for a
+  FixedPaddedLayout an immediate.
+*/
+template <class S, class L, class F, size_t... I>
+MF_ALWAYS_INLINE void forEachStencilNeighbor(const L &l, size_t s, F &f, std::index_sequence<I...>) {
+  int expand[] = {(f(l.neighbor(s, std::integral_constant<size_t, S::index(I)>::value)), 0)...};
+  (void)expand;
+}
+
+/*!
+  BoundedTopology is the original board: neighbors off the edge land in
+  the layout's border, which is never opened and has no bombs, so the
+  loops need no bounds checks.
+*/
+template <class L, class S>
+class BoundedTopology {
+ public:
+  explicit BoundedTopology(const L &l) : layout(l) {}
+
+  size_t slots() const { return layout.slots(); }
+  size_t slot(size_t x, size_t y, size_t z) const { return layout.slot(x,y,z); }
+  void position(size_t s, size_t &x, size_t &y, size_t &z) const { layout.position(s,x,y,z); }
+
+  template <class F>
+  void forEachNeighbor(size_t s, F f) const {
+    forEachStencilNeighbor<S>(layout, s, f, std::make_index_sequence<S::SIZE>());
+  }
+
+ private:
+  const L &layout;
+};
+
+/*!
+  TorusTopology wraps the board around on each axis, so a cell on one
+  face neighbors the cells on the opposite face.  Wrapping only matters
+  for cells on a face of the board, which edges flags, one byte per slot;
+  every other cell takes the same unrolled fixed offsets as
+  BoundedTopology, with no modulo and no per-neighbor branch.  Cells on a
+  face work out their neighbors from their position.
+
+  An axis shorter than 3 cells doesn't wrap, since a cell would be its
+  own neighbor, or one neighbor twice.
+*/
+template <class L, class S>
+class TorusTopology {
+ public:
+  TorusTopology(const L &l, const unsigned char *edges, size_t w, size_t h, size_t d)
+    : layout(l), edge(edges), wdth(w), hght(h), dpth(d) {}
+
+  size_t slots() const { return layout.slots(); }
+  size_t slot(size_t x, size_t y, size_t z) const { return layout.slot(x,y,z); }
+  void position(size_t s, size_t &x, size_t &y, size_t &z) const { layout.position(s,x,y,z); }
+
+  template <class F>
+  void forEachNeighbor(size_t s, F f) const {
+    if (!edge[s]) {
+      forEachStencilNeighbor<S>(layout, s, f, std::make_index_sequence<S::SIZE>());
+      return;
+    }
+
+    size_t x, y, z;
+    layout.position(s, x, y, z);
+    const size_t xs[3] = {wrap(x, -1, wdth), x, wrap(x, 1, wdth)};
+    const size_t ys[3] = {wrap(y, -1, hght), y, wrap(y, 1, hght)};
+    const size_t zs[3] = {wrap(z, -1, dpth), z, wrap(z, 1, dpth)};
+    wrapped(xs, ys, zs, f, std::make_index_sequence<S::SIZE>());
+  }
+
+ private:
+  // The neighbors of a cell on a face, from the wrapped coordinates on
+  // either side of it
+  template <class F, size_t... I>
+  MF_ALWAYS_INLINE void wrapped(const size_t *xs, const size_t *ys, const size_t *zs,
+				F &f, std::index_sequence<I...>) const {
+    int expand[] = {(f(layout.slot(xs[neighborDX(std::integral_constant<size_t, S::index(I)>::value)+1],
+				   ys[neighborDY(std::integral_constant<size_t, S::index(I)>::value)+1],
+				   zs[neighborDZ(std::integral_constant<size_t, S::index(I)>::value)+1])), 0)...};
+    (void)expand;
+  }
+
+  // Steps v by dv along an axis of n cells.  Off the end of an axis
+  // that doesn't wrap, it's -1 or n, which the layouts put in the border.
+  static size_t wrap(size_t v, int dv, size_t n) {
+    if (n >= 3) {
+      if (dv < 0 && v == 0) return n-1;
+      if (dv > 0 && v == n-1) return 0;
+    }
+    return v + dv;
+  }
+
+  const L &layout;
+  const unsigned char *edge;
+  size_t wdth;
+  size_t hght;
+  size_t dpth;
+};
+
+#endif
@@ -0,0 +1,150 @@
+/*
+  parallel.cpp
+ 
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+
+// Requested thread count, 0 for one per core
+static std::atomic<unsigned> requested_threads(0);
+
+/*!
+  Returns the number of threads to use.  touch() asks on every call on
+  big boards, and hardware_concurrency() can read /sys each time, so the
+  core count is looked up once.
+*/
+unsigned workerThreads() {
+  static const unsigned cores = std::thread::hardware_concurrency();
+  unsigned n = requested_threads;
+  if (n == 0) {
+    n = cores;
+  }
+  return (n == 0) ? 1 : n;
+}
+
+/*!
+  Sets the number of threads to use
+*/
+void setWorkerThreads(unsigned n) {
+  requested_threads = n;
+}
+
+/*!
+  WorkerPool keeps the threads runOnPool() uses.  They're started the
+  first time a job needs them and then wait on a condition variable for
+  the next job, which is numbered so each runs it once; they're stopped
+  and joined at exit.
+*/
+class WorkerPool {
+ public:
+  WorkerPool() : generation(0), active(0), remaining(0), stopping(false), task(0), context(0) {
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (size_t t=0; t<workers.size(); ++t) {
+      workers[t].join();
+    }
+  }
+
+  bool run(unsigned threads, void (*job)(void *, unsigned), void *job_context);
+
+ private:
+  void serve(unsigned worker);
+
+  // Held by the thread whose job the pool is running
+  std::mutex busy;
+
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  std::vector<std::thread> workers;
+  uint64_t generation;
+  unsigned active;
+  unsigned remaining;
+  bool stopping;
+  void (*task)(void *, unsigned);
+  void *context;
+};
+
+// Set on the pool's threads, and on a thread while its job runs, so a
+// job that starts another runs it itself rather than wait for a pool
+// that's waiting for it
+static thread_local bool in_pool = false;
+
+void WorkerPool::serve(unsigned worker) {
+  in_pool = true;
+  uint64_t seen = 0;
+  std::unique_lock<std::mutex> guard(lock);
+  for (;;) {
+    wake.wait(guard, [&]() { return stopping || generation != seen; });
+    if (stopping) return;
+    seen = generation;
+    if (worker >= active) continue;
+
+    guard.unlock();
+    task(context, worker);
+    guard.lock();
+    if (--remaining == 0) {
+      done.notify_one();
+    }
+  }
+}
+
+bool WorkerPool::run(unsigned threads, void (*job)(void *, unsigned), void *job_context) {
+  if (in_pool || !busy.try_lock()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> hold(busy, std::adopt_lock);
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    while (workers.size() < threads-1) {
+      workers.emplace_back(&WorkerPool::serve, this, unsigned(workers.size()+1));
+    }
+    task = job;
+    context = job_context;
+    active = threads;
+    remaining = threads-1;
+    ++generation;
+  }
+  wake.notify_all();
+
+  in_pool = true;
+  job(job_context, 0);
+  in_pool = false;
+
+  std::unique_lock<std::mutex> guard(lock);
+  done.wait(guard, [&]() { return remaining == 0; });
+  return true;
+}
+
+bool runOnPool(unsigned threads, void (*task)(void *, unsigned), void *context) {
+  static WorkerPool pool;
+  return pool.run(threads, task, context);
+}
@@ -0,0 +1,89 @@
+/*
+  parallel.h
+ 
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <cstddef>
+
+// Returns the number of threads parallelFor() uses
+unsigned workerThreads();
+
+// Sets the number of threads parallelFor() uses.  0 means one per core.
+void setWorkerThreads(unsigned n);
+
+// Runs task(context, worker) once for each worker in [0, threads), with
+// worker 0 on the calling thread and the rest on the shared pool's
+// threads, and returns when all have finished.  Returns false without
+// running anything if the pool is already in use, by another thread or
+// by a task further up this thread's stack.
+bool runOnPool(unsigned threads, void (*task)(void *, unsigned), void *context);
+
+/*!
+  parallelFor() calls f(i, worker) for every i in [0, n), spread over
+  workerThreads() threads, and returns when all calls have finished.
+  worker is the index of the calling thread, in [0, workerThreads()),
+  so f can keep per-thread results.  Tasks are handed out one at a time,
+  so the order and thread of each call vary from run to run; f must not
+  throw.
+
+  The threads are kept waiting in a pool between calls, so a caller that
+  runs many short loops in a row, such as a breadth first search level
+  by level, doesn't start threads for each.  A parallelFor() inside f,
+  or one called while another thread's is running, runs on the calling
+  thread alone.
+
+  Callers that size per-thread results before the call should read
+  workerThreads() once and pass it in, so a setWorkerThreads() from
+  another thread in between can't give f a worker index past the end.
+*/
+template <class F>
+void parallelFor(size_t n, unsigned threads, F f) {
+  if (threads > n) threads = unsigned(n);
+  if (threads > 1) {
+    struct Job {
+      size_t n;
+      std::atomic<size_t> next;
+      F *f;
+    } job;
+    job.n = n;
+    job.next = 0;
+    job.f = &f;
+    auto work = [](void *context, unsigned worker) {
+      Job &j = *static_cast<Job *>(context);
+      for (size_t i = j.next++; i < j.n; i = j.next++) {
+	(*j.f)(i, worker);
+      }
+    };
+    if (runOnPool(threads, work, &job)) return;
+  }
+  for (size_t i=0; i<n; ++i) {
+    f(i, 0u);
+  }
+}
+
+template <class F>
+void parallelFor(size_t n, F f) {
+  parallelFor(n, workerThreads(), f);
+}
+
+#endif
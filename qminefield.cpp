@@ -21,6 +21,7 @@
 
 #include <QMainWindow>
 
+#include <cstdlib>
 #include <sstream>
 #include <stdexcept>
 
@@ -29,8 +30,10 @@
 /*!
   Initializes the object and sets the OpenGL format.
 */
-QMinefield::QMinefield(QWidget*) : mf(0), rotationX(0.0), rotationY(0.0),
-				   rotationZ(0.0), translate(10.0), lost(false) {
+QMinefield::QMinefield(QWidget*) : mf(0), solver(0), auto_open(false), helped(false),
+				   rotationX(0.0), rotationY(0.0),
+				   rotationZ(0.0), translate(10.0), lost(false),
+				   stencil(corner_stencil), topology(bounded_topology) {
   setFormat(QGLFormat(QGL::DoubleBuffer | QGL::DepthBuffer));
 }
 
@@ -42,6 +45,8 @@ QMinefield::~QMinefield() {
     glDeleteLists(dispLists[i], 1);
   }
 
+  if (solver)
+    delete solver;
   if (mf)
     delete mf;
 
@@ -52,15 +57,47 @@ QMinefield::~QMinefield() {
   Creates a new Minefield and resest the view
 */
 void QMinefield::startNewGame(size_t w, size_t h, size_t d, size_t n) {
-  if (mf)
-    delete mf;
   clicked = false;
   lost = false;
-  mf = new Minefield(w,h,d,n);
+  helped = false;
+  uint64_t seed = (uint64_t(std::rand()) << 32) ^ uint64_t(std::rand());
+  if (mf)
+    mf->reset(w,h,d,n,seed);
+  else
+    mf = new Minefield(w,h,d,n,seed);
+  if (mf->stencil() != stencil || mf->topology() != topology)
+    mf->setNeighborhood(stencil, topology);
+  if (solver)
+    solver->rebuild();
+  else if (auto_open)
+    solver = new MinefieldSolver(*mf);
   resetView();
   //  updateGL();
 }
 
+/*!
+  Sets which cells count as neighbors, and whether the board wraps
+  around, for the next game started
+*/
+void QMinefield::setNeighborhood(mf_stencil_t st, mf_topology_t tp) {
+  stencil = st;
+  topology = tp;
+}
+
+/*!
+  Turns auto open on or off.  The solver is only kept while it's on, and
+  is made with the board if there isn't one yet.
+*/
+void QMinefield::setAutoOpen(bool on) {
+  if (on && !solver && mf) {
+    solver = new MinefieldSolver(*mf);
+  } else if (!on && solver) {
+    delete solver;
+    solver = 0;
+  }
+  auto_open = on;
+}
+
 /*!
   Loads the material arrays
 */
@@ -312,21 +349,19 @@ void QMinefield::decodeBox(size_t val, size_t &x, size_t &y, size_t &z) {
 }
 
 /*!
-  Loops through the mine and draws each cell
+  Loops through the runs of cells that have something to draw, and draws each cell
 */
 void QMinefield::drawMine() {
   if (!mf) return;
   
   glPushMatrix();
-  size_t d = mf->depth();
-  size_t h = mf->height();
-  size_t w = mf->width();
-  
-  for (size_t i=0; i<w; ++i) {
-    for (size_t j=0; j<h; ++j) {
-      for (size_t k=0; k<d; ++k) {
-	drawCell(i,j,k);
-      }
+
+  // Cleared cells are never drawn, and once the game is lost neither are
+  // the numbers, so whole runs of them are skipped
+  unsigned views = lost ? (CLOSED_RUNS | MARKED_RUNS) : VISIBLE_RUNS;
+  for (const mf_run_t &run : mf->runs(views)) {
+    for (size_t i=run.x; i<run.x+run.length; ++i) {
+      drawCell(i,run.y,run.z);
     }
   }
   glPopMatrix();
@@ -767,6 +802,11 @@ void QMinefield::mousePressEvent(QMouseEvent *event) {
   if (temp>=0) {
     decodeBox(temp, x,y,z);
   }
+
+  // Whether the click changed the board.  It's read before openSafe()
+  // replaces changes(), and openSafe() only runs after a change, so it
+  // covers anything that opens too.
+  bool changed = false;
   
   if (event->buttons() & Qt::LeftButton) {
     
@@ -778,9 +818,16 @@ void QMinefield::mousePressEvent(QMouseEvent *event) {
 	lost = true;
 	updateGL();
 	emit gameLost();
+	return;
       } else {
 	// Clicked on an empty cell, so touch it
 	mf->touch(x,y,z);
+	changed = !mf->changes().empty();
+
+	// and open whatever that shows to be safe
+	if (solver && changed && solver->openSafe() > 0) {
+	  helped = true;
+	}
 	
 	// Check for a win
 	if (mf->hasWon()) {
@@ -792,12 +839,15 @@ void QMinefield::mousePressEvent(QMouseEvent *event) {
     // Marked a cell
     if (temp>=0) {
       mf->mark(x,y,z);
+      changed = !mf->changes().empty();
       emit bombMarked(mf->minesRemaining());
     }
   }
   
-  // Update the display
-  updateGL();
+  // Update the display if the click changed anything
+  if (changed) {
+    updateGL();
+  }
 }
 
 /*!
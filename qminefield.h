@@ -27,6 +27,7 @@
 #include <GL/glu.h>
 
 #include "minefield.h"
+#include "minefieldsolver.h"
 
 // Some constants...
 static const size_t NUM_MATERIALS=4;
@@ -53,7 +54,17 @@ class QMinefield : public QGLWidget {
   
   void startNewGame(size_t w, size_t h, size_t d, size_t n);
 
+  // Sets the neighborhood for the games startNewGame() starts
+  void setNeighborhood(mf_stencil_t st, mf_topology_t tp);
+
   void resetView();
+
+  // Turns on or off opening the cells that are certainly safe after
+  // each click
+  void setAutoOpen(bool on);
+
+  // Whether auto open has opened anything in this game
+  bool wasHelped() const { return helped; }
   
  signals:
   // gameLost() is emitted when the game is lost
@@ -127,6 +138,12 @@ class QMinefield : public QGLWidget {
   // The actual minefield
   Minefield *mf;
 
+  // Finds the safe cells for auto open, if it's on, and whether it's
+  // opened any this game
+  MinefieldSolver *solver;
+  bool auto_open;
+  bool helped;
+
   // Stores last mouse position for rotation
   QPoint lastPos;
 
@@ -142,4 +159,8 @@ class QMinefield : public QGLWidget {
   bool lost;
 
   bool clicked;
+
+  // Neighborhood of new games
+  mf_stencil_t stencil;
+  mf_topology_t topology;
 };
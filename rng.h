@@ -0,0 +1,159 @@
+/*
+  rng.h
+ 
+  Copyright (C) 2008 Jeremiah LaRocco
+
+  This file is part of Minesweeper3D
+
+  Minesweeper3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minesweeper3D is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minesweeper3D.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+/*!
+  One step of the splitmix64 generator.  Good for hashing a seed into
+  generator state.
+*/
+inline uint64_t splitmix64(uint64_t &state) {
+  uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/*!
+  Xoshiro256 is the xoshiro256** generator: fast, small, and good enough
+  for placing mines.  Unlike rand() each instance has its own state, and
+  the same seed always gives the same sequence.
+*/
+class Xoshiro256 {
+ public:
+  Xoshiro256(uint64_t seed=0) { reseed(seed); }
+
+  // Restarts the sequence from the given seed
+  void reseed(uint64_t seed) {
+    uint64_t sm = seed;
+    for (int i=0; i<4; ++i) {
+      s[i] = splitmix64(sm);
+    }
+  }
+
+  // Returns the next 64 random bits
+  uint64_t next() {
+    uint64_t result = rotl(s[1]*5, 7)*9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+  }
+
+  // Skips ahead 2^128 values, so each of several generators started from
+  // the same seed and jumped a different number of times gives its own
+  // stream that never overlaps the others
+  void jump() {
+    static const uint64_t JUMP[4] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+				     0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+    uint64_t t[4] = {0, 0, 0, 0};
+    for (int i=0; i<4; ++i) {
+      for (int b=0; b<64; ++b) {
+	if (JUMP[i] & (uint64_t(1) << b)) {
+	  for (int k=0; k<4; ++k) {
+	    t[k] ^= s[k];
+	  }
+	}
+	next();
+      }
+    }
+    for (int k=0; k<4; ++k) {
+      s[k] = t[k];
+    }
+  }
+
+  // Returns a uniformly distributed value in [0, n), without modulo bias
+  // (Lemire's multiply and reject method; the retry is very rare)
+  uint64_t below(uint64_t n) {
+    uint64_t low;
+    uint64_t high = mul128(next(), n, low);
+    if (low < n) {
+      uint64_t threshold = -n % n;
+      while (low < threshold) {
+	high = mul128(next(), n, low);
+      }
+    }
+    return high;
+  }
+
+ private:
+  static uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64-k));
+  }
+
+  // Returns the high 64 bits of a*b and stores the low 64 bits in low
+  static uint64_t mul128(uint64_t a, uint64_t b, uint64_t &low) {
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 m = (unsigned __int128)a * b;
+    low = uint64_t(m);
+    return uint64_t(m >> 64);
+#else
+    uint64_t a_lo = a & 0xffffffffULL, a_hi = a >> 32;
+    uint64_t b_lo = b & 0xffffffffULL, b_hi = b >> 32;
+    uint64_t ll = a_lo*b_lo, lh = a_lo*b_hi, hl = a_hi*b_lo, hh = a_hi*b_hi;
+    uint64_t mid = (ll >> 32) + (lh & 0xffffffffULL) + (hl & 0xffffffffULL);
+    low = (mid << 32) | (ll & 0xffffffffULL);
+    return hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+  }
+
+  uint64_t s[4];
+};
+
+/*!
+  philox4x32() is the Philox4x32-10 counter based generator: it turns a
+  128 bit counter and a 64 bit key into 128 random bits, with no state.
+  Any cell's random bits can be computed from its index alone, so a board
+  can be generated in pieces, in any order, on any number of threads.
+*/
+inline void philox4x32(uint32_t ctr[4], const uint64_t key) {
+  uint32_t k0 = uint32_t(key), k1 = uint32_t(key >> 32);
+  for (int round=0; round<10; ++round) {
+    uint64_t p0 = uint64_t(0xD2511F53) * ctr[0];
+    uint64_t p1 = uint64_t(0xCD9E8D57) * ctr[2];
+    uint32_t c0 = uint32_t(p1 >> 32) ^ ctr[1] ^ k0;
+    uint32_t c2 = uint32_t(p0 >> 32) ^ ctr[3] ^ k1;
+    ctr[0] = c0;
+    ctr[1] = uint32_t(p1);
+    ctr[2] = c2;
+    ctr[3] = uint32_t(p0);
+    k0 += 0x9E3779B9;
+    k1 += 0xBB67AE85;
+  }
+}
+
+/*!
+  Returns 64 random bits for the given counter and key
+*/
+inline uint64_t philox64(const uint64_t counter, const uint64_t key) {
+  uint32_t ctr[4] = {uint32_t(counter), uint32_t(counter >> 32), 0, 0};
+  philox4x32(ctr, key);
+  return (uint64_t(ctr[1]) << 32) | ctr[0];
+}
+
+#endif